@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "bg.h"
+#include "arena.h"
+
+struct arena_block
+{
+	arena_block_t* next;
+	size_t size; //bytes in data
+	size_t used;
+	char data[] __attribute__((aligned(64)));
+};
+
+static arena_block_t* BlockNew(size_t size, arena_block_t* next)
+{
+	arena_block_t* b = aligned_alloc(64, (sizeof(*b) + size + 63) & ~(size_t)63);
+	ASSERT(b, "Out of memory!");
+	b->next = next;
+	b->size = size;
+	b->used = 0;
+	return b;
+}
+
+void* arena_alloc(arena_t* a, size_t size, size_t align)
+{
+	ASSERT(align && align <= 64 && !(align & (align - 1)), "Bad arena alignment!");
+	arena_block_t* b = a->head;
+	if(b)
+	{
+		size_t at = (b->used + align - 1) & ~(align - 1);
+		if(at + size <= b->size)
+		{
+			b->used = at + size;
+			return b->data + at;
+		}
+	}
+	//overflow: a new block for this frame, merged with the others at reset
+	size_t grow = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+	a->head = b = BlockNew(grow, b);
+	a->total += grow;
+	b->used = size;
+	return b->data; //block data is 64 byte aligned
+}
+
+void arena_reset(arena_t* a)
+{
+	arena_block_t* b = a->head;
+	if(!b)
+		return;
+	size_t used = 0;
+	for(arena_block_t* i = b; i; i = i->next)
+		used += i->used;
+	if(used > a->peak)
+		a->peak = used;
+	if(b->next)
+	{
+		size_t total = a->total;
+		arena_free(a);
+		a->head = BlockNew(total, NULL);
+		a->total = total;
+		return;
+	}
+	b->used = 0;
+}
+
+void arena_free(arena_t* a)
+{
+	while(a->head)
+	{
+		arena_block_t* next = a->head->next;
+		free(a->head);
+		a->head = next;
+	}
+	a->total = 0;
+}
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+static __thread arena_t* thread_arena;
+
+static void ArenaDestroy(void* arg)
+{
+	arena_free(arg);
+	free(arg);
+}
+
+static void ArenaKey(void)
+{
+	pthread_key_create(&arena_key, ArenaDestroy);
+}
+
+arena_t* arena_thread(void)
+{
+	if(!thread_arena)
+	{
+		pthread_once(&arena_once, ArenaKey);
+		thread_arena = calloc(1, sizeof(arena_t));
+		ASSERT(thread_arena, "Out of memory!");
+		pthread_setspecific(arena_key, thread_arena); //retired workers free theirs
+	}
+	return thread_arena;
+}
+
+void objpool_init(objpool_t* p, size_t size, size_t align, int per_slab)
+{
+	if(align < sizeof(void*))
+		align = sizeof(void*);
+	if(size < sizeof(void*))
+		size = sizeof(void*);
+	pthread_mutex_init(&p->lock, NULL);
+	p->size = (size + align - 1) & ~(align - 1);
+	p->align = align;
+	p->per_slab = per_slab > 0 ? per_slab : 1;
+	p->free = NULL;
+	p->slabs = NULL;
+}
+
+//slab: link to the previous slab in the first align bytes, objects after it
+static void SlabNew(objpool_t* p)
+{
+	size_t head = p->align;
+	char* slab = aligned_alloc(p->align, head + p->size * p->per_slab);
+	ASSERT(slab, "Out of memory!");
+	*(void**)slab = p->slabs;
+	p->slabs = slab;
+	for(int i = p->per_slab - 1; i >= 0; i--)
+	{
+		void* obj = slab + head + p->size * i;
+		*(void**)obj = p->free;
+		p->free = obj;
+	}
+}
+
+void* objpool_get(objpool_t* p)
+{
+	pthread_mutex_lock(&p->lock);
+	if(!p->free)
+		SlabNew(p);
+	void* obj = p->free;
+	p->free = *(void**)obj;
+	pthread_mutex_unlock(&p->lock);
+	memset(obj, 0, p->size);
+	return obj;
+}
+
+void objpool_put(objpool_t* p, void* obj)
+{
+	if(!obj)
+		return;
+	pthread_mutex_lock(&p->lock);
+	*(void**)obj = p->free;
+	p->free = obj;
+	pthread_mutex_unlock(&p->lock);
+}
@@ -0,0 +1,50 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * Scratch and object allocators that keep malloc off the hot path.
+ *
+ * An arena is a bump allocator for data that lives one frame or one
+ * effect step: every thread has its own (arena_thread()), nothing is
+ * freed individually and arena_reset() drops everything at once. Blocks
+ * are kept across resets; when a frame needed more than one block they
+ * are merged into a single one, so steady state allocates nothing.
+ *
+ * An objpool hands out fixed-size objects from slabs and takes them back
+ * on a free list, for state that outlives a frame but is recreated often.
+ */
+
+#define ARENA_BLOCK (64 * 1024)
+
+typedef struct arena_block arena_block_t;
+
+typedef struct arena
+{
+	arena_block_t* head; //current block, older ones behind it
+	size_t total;        //bytes in all blocks
+	size_t peak;         //largest total use between two resets
+} arena_t;
+
+void* arena_alloc(arena_t* a, size_t size, size_t align); //align up to 64, never NULL
+void arena_reset(arena_t* a);
+void arena_free(arena_t* a);
+arena_t* arena_thread(void); //freed when the thread exits
+
+typedef struct objpool
+{
+	pthread_mutex_t lock;
+	size_t size;  //object size rounded up to align
+	size_t align;
+	int per_slab;
+	void* free;   //free list threaded through the objects
+	void* slabs;
+} objpool_t;
+
+void objpool_init(objpool_t* p, size_t size, size_t align, int per_slab);
+void* objpool_get(objpool_t* p); //zeroed, never NULL
+void objpool_put(objpool_t* p, void* obj);
+
+#endif /* _ARENA_H_ */
@@ -0,0 +1,43 @@
+#ifndef _BG_H_
+#define _BG_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * State shared between main, the effect runner and effects (built-in or
+ * loaded from plugins, the executable exports these with -rdynamic).
+ */
+
+#define DEBUG
+#ifdef DEBUG
+# define ASSERT(condition, message) \
+	do { \
+	if (! (condition)) \
+		{ \
+			printf("%s \n", message);\
+			printf("Assertion %s failed in, %s line: %d \n", #condition, __FILE__, __LINE__);\
+			char buf[10];					\
+			fgets(buf, 10, stdin); \
+			exit(1); \
+	} \
+	} while (0)
+#else
+# define ASSERT(condition, message) do { } while (0)
+#endif
+
+extern int w;
+extern int h;
+extern int left; //the shared signal, guarded by lock
+extern pthread_mutex_t lock;
+
+uint64_t GetTimerValue();
+double GetTime();
+int WaitVisible();
+int GetSignal();
+void SetSignal(int value);
+void PostFeedback(int thread, int state);
+
+#endif /* _BG_H_ */
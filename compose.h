@@ -0,0 +1,43 @@
+#ifndef _COMPOSE_H_
+#define _COMPOSE_H_
+
+#include <X11/Xlib.h>
+#include <stdint.h>
+
+/**
+ * Layered frames for the raster backends. Every enabled effect draws
+ * into a layer of its own, an image in the frame's format allocated
+ * when the effect is first prepared or started; pixel 0 is transparent.
+ * Once per frame compose_frame() blends the layers in effect id order
+ * into the frame with their opacity and blend mode, set with --option
+ * E.blend=normal|add|lighten and E.opacity=0..1. Layers of effects
+ * with EFFECT_HINT_ERASES are erasers instead: what they draw clears
+ * every other layer underneath, the way CirclePurge used to paint over
+ * the shared image.
+ *
+ * Effects fade in when they start and out when they are stopped or
+ * their last instance exits, so handovers such as CircleFrac to
+ * Lightning cross-fade; a layer faded out is cleared. Both are decided
+ * on main, in lockstep export at the same tick on every run. The draw.h
+ * primitives report what they touch through compose_damage() and only
+ * those COMPOSE_TILE tiles, plus the tiles of a fading layer, are
+ * blended again, split across the pool by tile rows. On x86 the row
+ * kernels are built for AVX2 and the baseline and picked at load time.
+ *
+ * The server backend draws on the X server and has no layers,
+ * compose_layer() then returns NULL and effects share the frame.
+ */
+
+#define COMPOSE_TILE 64
+#define COMPOSE_FADE 0.75 //seconds for a fade in or out
+
+enum { COMPOSE_NORMAL, COMPOSE_ADD, COMPOSE_LIGHTEN, COMPOSE_ERASE };
+
+void compose_open(XImage* frame);           //a layer per enabled effect, after the effects are registered
+void compose_attach(int id);                //allocate the effect's layer before an instance is created, main only
+XImage* compose_layer(int id);              //the effect's layer or NULL
+void compose_show(int id, int visible);     //fade the effect's layer in or out, main only
+void compose_damage(XImage* img, int x, int y, int width, int height); //ignored for images that are not layers
+void compose_frame(double t);               //blend the changed tiles into the frame, main only
+
+#endif /* _COMPOSE_H_ */
@@ -0,0 +1,555 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "bg.h"
+#include "arena.h"
+#include "draw.h"
+#include "present.h"
+#include "compose.h"
+#include "trace.h"
+
+#define DRAW_BATCH 1024
+#define DRAW_QUEUE_MAX (1 << 20) //commands per frame
+#define DRAW_FULL_WAIT_MS 50      //a full queue waits this long for main to replay it, then drops
+
+enum { cmd_point, cmd_segment, cmd_arc, cmd_fill, cmd_rect };
+
+typedef struct
+{
+	uint32_t color;
+	uint16_t type;
+	int16_t v[4];
+} draw_cmd_t;
+
+static int mode = DRAW_RASTER;
+static __thread draw_cmd_t batch[DRAW_BATCH];
+static __thread int batch_n;
+static draw_cmd_t* queue[2];
+static size_t queue_n[2];
+static size_t queue_cap[2];
+static int back = 0; //the queue workers append to
+static uint64_t swaps = 0;
+static size_t dropped = 0; //commands lost since the last report
+static double reported = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_swapped = PTHREAD_COND_INITIALIZER;
+
+void draw_backend(int backend)
+{
+	mode = backend;
+}
+
+int draw_server(void)
+{
+	return mode == DRAW_SERVER;
+}
+
+static int16_t Short(int v)
+{
+	return v < -32768 ? -32768 : v > 32767 ? 32767 : v;
+}
+
+static void Record(int type, uint32_t color, int a, int b, int c, int d)
+{
+	if(batch_n == DRAW_BATCH)
+		draw_flush();
+	draw_cmd_t* cmd = &batch[batch_n++];
+	cmd->color = color;
+	cmd->type = type;
+	cmd->v[0] = Short(a);
+	cmd->v[1] = Short(b);
+	cmd->v[2] = Short(c);
+	cmd->v[3] = Short(d);
+}
+
+static int ByColor(const void* a, const void* b)
+{
+	const draw_cmd_t* x = a;
+	const draw_cmd_t* y = b;
+	if(x->color != y->color)
+		return x->color < y->color ? -1 : 1;
+	return (int)x->type - (int)y->type;
+}
+
+void draw_flush(void)
+{
+	if(!batch_n)
+		return;
+	//sorted here, on the worker, so main issues long runs of one colour
+	qsort(batch, batch_n, sizeof(batch[0]), ByColor);
+	pthread_mutex_lock(&queue_lock);
+	if(queue_n[back] + batch_n > DRAW_QUEUE_MAX)
+	{
+		//a dense frame, hold the step until main has taken the queue
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += DRAW_FULL_WAIT_MS * 1000000L;
+		until.tv_sec += until.tv_nsec / 1000000000;
+		until.tv_nsec %= 1000000000;
+		uint64_t seen = swaps;
+		while(swaps == seen)
+			if(pthread_cond_timedwait(&queue_swapped, &queue_lock, &until) == ETIMEDOUT)
+				break;
+	}
+	size_t n = queue_n[back];
+	if(n + batch_n > queue_cap[back] && n + batch_n <= DRAW_QUEUE_MAX)
+	{
+		size_t cap = queue_cap[back] ? queue_cap[back] : 4096;
+		while(cap < n + batch_n)
+			cap *= 2;
+		draw_cmd_t* grown = realloc(queue[back], cap * sizeof(draw_cmd_t));
+		if(grown)
+		{
+			queue[back] = grown;
+			queue_cap[back] = cap;
+		}
+	}
+	if(n + batch_n <= queue_cap[back])
+	{
+		memcpy(queue[back] + n, batch, batch_n * sizeof(draw_cmd_t));
+		queue_n[back] = n + batch_n;
+	} else
+		dropped += batch_n;
+	pthread_mutex_unlock(&queue_lock);
+	batch_n = 0;
+}
+
+void draw_replay(Display* dpy, Drawable d, GC gc)
+{
+	pthread_mutex_lock(&queue_lock);
+	int front = back;
+	back ^= 1;
+	swaps++;
+	pthread_cond_broadcast(&queue_swapped);
+	size_t lost = dropped;
+	if(lost && GetTime() - reported >= 1)
+	{
+		dropped = 0;
+		reported = GetTime();
+	} else
+		lost = 0;
+	pthread_mutex_unlock(&queue_lock);
+	if(lost)
+		printf("Server backend queue full, %zu primitives dropped\n", lost);
+
+	TRACE_BEGIN("draw_replay");
+	draw_cmd_t* cmd = queue[front];
+	size_t n = queue_n[front];
+	arena_t* scratch = arena_thread();
+	uint32_t fg = 0;
+	int first = 1;
+	for(size_t i = 0; i < n;)
+	{
+		//one request per run of the same colour and type
+		size_t run = 1;
+		while(i + run < n && cmd[i + run].color == cmd[i].color && cmd[i + run].type == cmd[i].type)
+			run++;
+		if(first || cmd[i].color != fg)
+		{
+			fg = cmd[i].color;
+			XSetForeground(dpy, gc, fg);
+			first = 0;
+		}
+		if(cmd[i].type == cmd_point)
+		{
+			XPoint* p = arena_alloc(scratch, run * sizeof(XPoint), 4);
+			for(size_t k = 0; k < run; k++)
+			{
+				p[k] = (XPoint){cmd[i + k].v[0], cmd[i + k].v[1]};
+				present_damage(p[k].x, p[k].y, 1, 1);
+			}
+			XDrawPoints(dpy, d, gc, p, run, CoordModeOrigin);
+		} else if(cmd[i].type == cmd_segment) {
+			XSegment* s = arena_alloc(scratch, run * sizeof(XSegment), 4);
+			for(size_t k = 0; k < run; k++)
+			{
+				s[k] = (XSegment){cmd[i + k].v[0], cmd[i + k].v[1], cmd[i + k].v[2], cmd[i + k].v[3]};
+				int x = s[k].x1 < s[k].x2 ? s[k].x1 : s[k].x2;
+				int y = s[k].y1 < s[k].y2 ? s[k].y1 : s[k].y2;
+				present_damage(x, y, abs(s[k].x2 - s[k].x1) + 1, abs(s[k].y2 - s[k].y1) + 1);
+			}
+			XDrawSegments(dpy, d, gc, s, run);
+		} else if(cmd[i].type == cmd_rect) {
+			XRectangle* r = arena_alloc(scratch, run * sizeof(XRectangle), 4);
+			for(size_t k = 0; k < run; k++)
+			{
+				r[k] = (XRectangle){cmd[i + k].v[0], cmd[i + k].v[1], cmd[i + k].v[2], cmd[i + k].v[3]};
+				present_damage(r[k].x, r[k].y, r[k].width, r[k].height);
+			}
+			XFillRectangles(dpy, d, gc, r, run);
+		} else {
+			XArc* a = arena_alloc(scratch, run * sizeof(XArc), 4);
+			for(size_t k = 0; k < run; k++)
+			{
+				a[k] = (XArc){cmd[i + k].v[0], cmd[i + k].v[1], cmd[i + k].v[2], cmd[i + k].v[3], 0, 360 * 64};
+				present_damage(a[k].x, a[k].y, a[k].width + 1, a[k].height + 1);
+			}
+			if(cmd[i].type == cmd_fill)
+				XFillArcs(dpy, d, gc, a, run);
+			else
+				XDrawArcs(dpy, d, gc, a, run);
+		}
+		i += run;
+	}
+	queue_n[front] = 0;
+	TRACE_END("draw_replay");
+}
+
+void Plot(XImage* img, int x, int y, uint32_t color)
+{
+	if(mode == DRAW_SERVER)
+		Record(cmd_point, color, x, y, 0, 0);
+	else {
+		XPutPixel(img, x, y, color);
+		compose_damage(img, x, y, 1, 1);
+	}
+}
+
+void FillRect(XImage* img, int x, int y, int width, int height, uint32_t color)
+{
+	if(mode == DRAW_SERVER)
+	{
+		Record(cmd_rect, color, x, y, width, height);
+		return;
+	}
+	int x0 = x < 0 ? 0 : x, x1 = x + width > w ? w : x + width;
+	int y0 = y < 0 ? 0 : y, y1 = y + height > h ? h : y + height;
+	for(int py = y0; py < y1; py++)
+		for(int px = x0; px < x1; px++)
+			XPutPixel(img, px, py, color);
+	compose_damage(img, x, y, width, height);
+}
+
+void CircleFill(XImage* img, int32_t centreX, int32_t centreY, int32_t radius, uint32_t color)
+{
+	if(mode == DRAW_SERVER)
+	{
+		Record(cmd_fill, color, centreX - radius, centreY - radius, 2 * radius, 2 * radius);
+		return;
+	}
+	TRACE_BEGIN("CircleFill");
+	compose_damage(img, centreX - radius, centreY - radius, 2 * radius + 1, 2 * radius + 1);
+	const int32_t diameter = (radius * 2);
+	
+	int32_t x = (radius - 1);
+	int32_t y = 0;
+	int32_t tx = 1;
+	int32_t ty = 1;
+	int32_t error = (tx - diameter);
+	
+	while (x >= y)
+	{
+		//  Each of the following renders an octant of the circle
+		if (!(centreX + x < 0 || centreX + x >= w || centreY - y < 0 || centreY - y >= h))
+		{
+			XPutPixel(img, centreX + x, centreY - y, 0x00FF00FF);
+			for(int i = centreX + x; i>centreX-1; i--)
+				XPutPixel(img, i, centreY - y, color);
+		}
+		if (!(centreX - x < 0 || centreX - x >= w || centreY + y < 0 || centreY + y >= h))
+		{
+			XPutPixel(img, centreX - x, centreY + y, color);
+			for(int i = centreX - x; i<centreX+1; i++)
+				XPutPixel(img, i, centreY + y, color);
+		}
+		if (!(centreX + x < 0 || centreX + x >= w || centreY + y < 0 || centreY + y >= h))
+		{
+			XPutPixel(img, centreX + x, centreY + y, color);
+			for(int i = centreX + x; i>centreX-1; i--)
+				XPutPixel(img, i, centreY + y, color);
+		}
+		if (!(centreX - x < 0 || centreX - x >= w || centreY - y < 0 || centreY - y >= h))
+		{
+		 	XPutPixel(img, centreX - x, centreY - y, color);
+			for(int i = centreX - x; i<centreX+1; i++)
+				XPutPixel(img, i, centreY - y, color);
+	 	}
+		if (!(centreX + y < 0 || centreX + y >= w || centreY - x < 0 || centreY - x >= h))
+		{			  	
+			XPutPixel(img, centreX + y, centreY - x, color);
+			for(int i = centreX + y; i>centreX-1; i--)
+				XPutPixel(img, i, centreY - x, color);
+		}
+		if (!(centreX - y < 0 || centreX - y >= w || centreY + x < 0 || centreY + x >= h))
+		{	
+			XPutPixel(img, centreX - y, centreY + x, color);
+			for(int i = centreX - y; i<centreX+1; i++)
+				XPutPixel(img, i, centreY + x, color);
+		}
+		if (!(centreX + y < 0 || centreX + y >= w || centreY + x < 0 || centreY + x >= h))
+		{	
+			XPutPixel(img, centreX + y, centreY + x, color);
+			for(int i = centreX + y; i>centreX-1; i--)
+				XPutPixel(img, i, centreY + x, color);
+		}
+		if (!(centreX - y < 0 || centreX - y >= w || centreY - x < 0 || centreY - x >= h))
+		{	
+			XPutPixel(img, centreX - y, centreY - x, color);
+			for(int i = centreX - y; i<centreX+1; i++)
+				XPutPixel(img, i, centreY - x, color);
+		}
+		if (error <= 0)
+		{
+			++y;
+			error += ty;
+			ty += 2;
+		}
+		if (error > 0)
+		{
+			--x;
+			tx += 2;
+			error += (tx - diameter);
+		}
+	}
+	TRACE_END("CircleFill");
+}
+
+void Circle(XImage* img, int32_t centreX, int32_t centreY, int32_t radius, uint32_t color)
+{
+	if(mode == DRAW_SERVER)
+	{
+		Record(cmd_arc, color, centreX - radius, centreY - radius, 2 * radius, 2 * radius);
+		return;
+	}
+	TRACE_BEGIN("Circle");
+	compose_damage(img, centreX - radius, centreY - radius, 2 * radius + 1, 2 * radius + 1);
+	const int32_t diameter = (radius * 2);
+	int32_t x = (radius - 1);
+	int32_t y = 0;
+	int32_t tx = 1;
+	int32_t ty = 1;
+	int32_t error = (tx - diameter);
+
+	while (x >= y)
+	{
+		//  Each of the following renders an octant of the circle
+		if (!(centreX + x < 0 || centreX + x >= w || centreY - y < 0 || centreY - y >= h))
+			XPutPixel(img, centreX + x, centreY - y, color);
+		if (!(centreX - x < 0 || centreX - x >= w || centreY + y < 0 || centreY + y >= h))
+			XPutPixel(img, centreX - x, centreY + y, color);
+		if (!(centreX + x < 0 || centreX + x >= w || centreY + y < 0 || centreY + y >= h))
+			XPutPixel(img, centreX + x, centreY + y, color);
+		if (!(centreX - x < 0 || centreX - x >= w || centreY - y < 0 || centreY - y >= h))
+		 	XPutPixel(img, centreX - x, centreY - y, color);
+		if (!(centreX + y < 0 || centreX + y >= w || centreY - x < 0 || centreY - x >= h))
+			XPutPixel(img, centreX + y, centreY - x, color);
+		if (!(centreX - y < 0 || centreX - y >= w || centreY + x < 0 || centreY + x >= h))
+			XPutPixel(img, centreX - y, centreY + x, color);
+		if (!(centreX + y < 0 || centreX + y >= w || centreY + x < 0 || centreY + x >= h))
+			XPutPixel(img, centreX + y, centreY + x, color);
+		if (!(centreX - y < 0 || centreX - y >= w || centreY - x < 0 || centreY - x >= h))
+			XPutPixel(img, centreX - y, centreY - x, color);
+		if (error <= 0)
+		{
+			++y;
+			error += ty;
+			ty += 2;
+		}
+		if (error > 0)
+		{
+			--x;
+			tx += 2;
+			error += (tx - diameter);
+		}
+	}
+	TRACE_END("Circle");
+}
+
+int bhm_line(XImage* img, uint32_t color, int x1,int y1,int x2,int y2)
+{
+	int x,y,dx,dy,dx1,dy1,px,py,xe,ye,i;
+	int pc = 0;
+	dx=x2-x1;
+	dy=y2-y1;
+	dx1=fabs(dx);
+	dy1=fabs(dy);
+	if(mode == DRAW_SERVER)
+	{
+		//the raster count estimated from how many end points are in the frame
+		int in = !(x1 < 0 || x1 >= w || y1 < 0 || y1 >= h) + !(x2 < 0 || x2 >= w || y2 < 0 || y2 >= h);
+		Record(cmd_segment, color, x1, y1, x2, y2);
+		return ((dx1 > dy1 ? dx1 : dy1) + 1) * in / 2;
+	}
+	TRACE_BEGIN("bhm_line");
+	compose_damage(img, x1 < x2 ? x1 : x2, y1 < y2 ? y1 : y2, dx1 + 1, dy1 + 1);
+	px=2*dy1-dx1;
+	py=2*dx1-dy1;
+	if(dy1<=dx1)
+	{
+		if(dx>=0)
+		{
+			x=x1;
+			y=y1;
+			xe=x2;
+		} else {
+			x=x2;
+			y=y2;
+			xe=x1;
+		}
+		if (!(x < 0 || x >= w || y < 0 || y >= h))
+		{
+			XPutPixel(img, x, y, color);
+			pc++;
+		}
+		for(i=0;x<xe;i++)
+		{
+			x=x+1;
+			if(px<0)
+				px=px+2*dy1;
+			else {
+				if((dx<0 && dy<0) || (dx>0 && dy>0))
+					y=y+1;
+				else
+					y=y-1;
+				px=px+2*(dy1-dx1);
+			}
+			if (!(x < 0 || x >= w || y < 0 || y >= h))
+			{
+				XPutPixel(img, x, y, color);
+				pc++;
+			}
+		}
+	} else {
+		if(dy>=0)
+		{
+			x=x1;
+			y=y1;
+			ye=y2;
+		} else {
+			x=x2;
+			y=y2;
+			ye=y1;
+		}
+		if (!(x < 0 || x >= w || y < 0 || y >= h))
+		{
+			XPutPixel(img, x, y, color);
+			pc++;
+		}
+		for(i=0;y<ye;i++)
+		{
+			y=y+1;
+			if(py<=0)
+				py=py+2*dx1;
+			else {
+				if((dx<0 && dy<0) || (dx>0 && dy>0))
+					x=x+1;
+				else
+					x=x-1;
+				py=py+2*(dx1-dy1);
+			}
+			if (!(x < 0 || x >= w || y < 0 || y >= h))
+			{
+				XPutPixel(img, x, y, color);
+				pc++;
+			}
+		}
+	}
+	TRACE_END("bhm_line");
+	return pc;
+}
+
+//Liang-Barsky against the frame, 0 when nothing is left
+static int Clip(float* x1, float* y1, float* x2, float* y2)
+{
+	float dx = *x2 - *x1;
+	float dy = *y2 - *y1;
+	float p[4] = {-dx, dx, -dy, dy};
+	float q[4] = {*x1, w - 1 - *x1, *y1, h - 1 - *y1};
+	float t0 = 0, t1 = 1;
+	for(int i = 0; i < 4; i++)
+	{
+		if(p[i] == 0)
+		{
+			if(q[i] < 0)
+				return 0;
+			continue;
+		}
+		float t = q[i] / p[i];
+		if(p[i] < 0)
+		{
+			if(t > t1)
+				return 0;
+			if(t > t0)
+				t0 = t;
+		} else {
+			if(t < t0)
+				return 0;
+			if(t < t1)
+				t1 = t;
+		}
+	}
+	*x2 = *x1 + t1 * dx;
+	*y2 = *y1 + t1 * dy;
+	*x1 += t0 * dx;
+	*y1 += t0 * dy;
+	return 1;
+}
+
+static int Clamp(float v, int max)
+{
+	int i = lrintf(v);
+	return i < 0 ? 0 : i > max ? max : i;
+}
+
+void draw_segments(XImage* img, const draw_seg_t* seg, int n)
+{
+	if(mode == DRAW_SERVER)
+	{
+		for(int i = 0; i < n; i++)
+			Record(cmd_segment, seg[i].color, seg[i].x1, seg[i].y1, seg[i].x2, seg[i].y2);
+		return;
+	}
+	TRACE_BEGIN("draw_segments");
+	int direct = img->bits_per_pixel == 32;
+	for(int i = 0; i < n; i++)
+	{
+		int x = seg[i].x1, y = seg[i].y1;
+		int x2 = seg[i].x2, y2 = seg[i].y2;
+		if((unsigned)x >= (unsigned)w || (unsigned)y >= (unsigned)h
+			|| (unsigned)x2 >= (unsigned)w || (unsigned)y2 >= (unsigned)h)
+		{
+			//most segments are inside, the others are cut to the frame
+			float fx1 = x, fy1 = y, fx2 = x2, fy2 = y2;
+			if(!Clip(&fx1, &fy1, &fx2, &fy2))
+				continue;
+			x = Clamp(fx1, w - 1);
+			y = Clamp(fy1, h - 1);
+			x2 = Clamp(fx2, w - 1);
+			y2 = Clamp(fy2, h - 1);
+		}
+		int dx = abs(x2 - x), sx = x < x2 ? 1 : -1;
+		int dy = -abs(y2 - y), sy = y < y2 ? 1 : -1;
+		compose_damage(img, x < x2 ? x : x2, y < y2 ? y : y2, dx + 1, 1 - dy);
+		int err = dx + dy;
+		uint32_t color = seg[i].color;
+		//both ends are inside, so is every pixel between them
+		while(1)
+		{
+			if(direct)
+				((uint32_t*)(img->data + (size_t)y * img->bytes_per_line))[x] = color;
+			else
+				XPutPixel(img, x, y, color);
+			if(x == x2 && y == y2)
+				break;
+			int e2 = 2 * err;
+			if(e2 >= dy)
+			{
+				err += dy;
+				x += sx;
+			}
+			if(e2 <= dx)
+			{
+				err += dx;
+				y += sy;
+			}
+		}
+	}
+	TRACE_END("draw_segments");
+}
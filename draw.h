@@ -0,0 +1,40 @@
+#ifndef _DRAW_H_
+#define _DRAW_H_
+
+#include <X11/Xlib.h>
+#include <stdint.h>
+
+/**
+ * Drawing primitives. The raster backend draws into the image, clipped
+ * to the w x h frame. The server backend records the primitives instead:
+ * each thread batches them (sorted by colour, handed over by draw_flush()
+ * or when the batch is full) and main replays a frame's worth as
+ * XDrawPoints/XDrawSegments/XDrawArcs/XFillArcs/XFillRectangles on the
+ * pixmap, so the traffic follows the number of primitives instead of
+ * the frame size. A frame's queue holds DRAW_QUEUE_MAX commands; a
+ * thread that fills it waits for the next replay, and what still does
+ * not fit is dropped and reported.
+ */
+
+#define DRAW_RASTER 0
+#define DRAW_SERVER 1
+
+typedef struct
+{
+	int16_t x1, y1, x2, y2;
+	uint32_t color;
+} draw_seg_t;
+
+void draw_backend(int backend);
+int draw_server(void);
+void draw_flush(void);                             //the effect runner calls it after every step
+void draw_replay(Display* dpy, Drawable d, GC gc); //main, server backend only
+
+void Plot(XImage* img, int x, int y, uint32_t color);
+void FillRect(XImage* img, int x, int y, int width, int height, uint32_t color);
+void CircleFill(XImage* img, int32_t centreX, int32_t centreY, int32_t radius, uint32_t color);
+void Circle(XImage* img, int32_t centreX, int32_t centreY, int32_t radius, uint32_t color);
+int bhm_line(XImage* img, uint32_t color, int x1,int y1,int x2,int y2); //returns pixels drawn, estimated by the server backend
+void draw_segments(XImage* img, const draw_seg_t* seg, int n); //clipped once per segment, not per pixel
+
+#endif /* _DRAW_H_ */
@@ -0,0 +1,442 @@
+#include <X11/Xlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <math.h>
+#include <dlfcn.h>
+#include "bg.h"
+#include "effect.h"
+#include "governor.h"
+#include "draw.h"
+#include "compose.h"
+#include "trace.h"
+
+#define DUE_SLACK 1e-6 //virtual clocks land exactly on the interval
+
+static const effect_t* effects[MAX_EFFECTS + 1]; //indexed by id
+static char enabled[MAX_EFFECTS + 1];
+static int by_default = 1; //no --effects list, the opt-in effects wait to be named
+static int cost_cap = 0;
+static int count = 0;
+static threadpool_t* effect_pool;
+static XImage* effect_img;
+static int running[MAX_EFFECTS + 1];  //live instances
+static int stop_gen[MAX_EFFECTS + 1]; //bumped by effect_stop, instances remember theirs
+static effect_ctx_t* prepared[MAX_EFFECTS + 1];
+static pthread_mutex_t prepare_lock = PTHREAD_MUTEX_INITIALIZER;
+static int lockstep = 0;
+//lockstep: live instances take turns in start order, guarded by step_lock
+static uint64_t* turns = NULL; //their tickets
+static int num_turns = 0, max_turns = 0;
+static uint64_t next_ticket = 1;
+static uint64_t serving = 0;   //the ticket whose turn it is, 0 for main's
+static pthread_mutex_t step_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t step_next = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t step_done = PTHREAD_COND_INITIALIZER;
+static char params[MAX_PARAMS][128]; //"Effect.key=value", the last one given wins
+static int num_params = 0;
+static objpool_t ctx_pool;
+static objpool_t state_pool[MAX_EFFECTS + 1]; //restarts reuse the memory of earlier runs
+
+int effect_register(const effect_t* desc)
+{
+	if(desc->abi != EFFECT_ABI || !desc->name || !desc->step || desc->interval < 0
+		|| (desc->tick && desc->timestep <= 0))
+	{
+		printf("Rejected effect %s: bad descriptor\n", desc->name ? desc->name : "?");
+		return -1;
+	}
+	if(count == MAX_EFFECTS || effect_find(desc->name))
+	{
+		printf("Rejected effect %s: registry full or duplicate name\n", desc->name);
+		return -1;
+	}
+	effects[++count] = desc;
+	enabled[count] = 1;
+	if(count == 1)
+		objpool_init(&ctx_pool, sizeof(effect_ctx_t), 32, MAX_EFFECTS);
+	objpool_init(&state_pool[count], desc->state_size, 64, 2);
+	return count;
+}
+
+int effect_load(const char* path)
+{
+	void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if(!handle)
+	{
+		printf("Unable to load plugin: %s\n", dlerror());
+		return -1;
+	}
+	void (*entry)(void) = (void (*)(void))dlsym(handle, EFFECT_PLUGIN_ENTRY);
+	if(!entry)
+	{
+		printf("Plugin %s has no %s\n", path, EFFECT_PLUGIN_ENTRY);
+		dlclose(handle);
+		return -1;
+	}
+	//the handle stays open, descriptors point into it
+	int before = count;
+	entry();
+	printf("Loaded %d effect(s) from %s\n", count - before, path);
+	return 0;
+}
+
+int effect_count(void)
+{
+	return count;
+}
+
+int effect_find(const char* name)
+{
+	for(int id = 1; id <= count; id++)
+		if(!strcmp(effects[id]->name, name))
+			return id;
+	return 0;
+}
+
+const effect_t* effect_get(int id)
+{
+	return id > 0 && id <= count ? effects[id] : NULL;
+}
+
+int effect_enable(const char* list, int max_cost)
+{
+	char name[64];
+	by_default = list == NULL;
+	cost_cap = max_cost;
+	for(int id = 1; id <= count; id++)
+		enabled[id] = list == NULL && !(effects[id]->hints & EFFECT_HINT_OPTIN);
+	while(list && *list)
+	{
+		size_t len = strcspn(list, ",");
+		if(len >= sizeof(name))
+			return -1;
+		memcpy(name, list, len);
+		name[len] = 0;
+		int id = effect_find(name);
+		if(!id)
+		{
+			printf("Unknown effect %s\n", name);
+			return -1;
+		}
+		enabled[id] = 1;
+		list += len;
+		if(*list == ',')
+			list++;
+	}
+	for(int id = 1; id <= count; id++)
+		if(max_cost > 0 && effects[id]->cost > max_cost)
+			enabled[id] = 0;
+	return 0;
+}
+
+int effect_enabled(int id)
+{
+	return id > 0 && id <= count && enabled[id];
+}
+
+void effect_opt_in(int id)
+{
+	if(by_default && id > 0 && id <= count && effects[id]->hints & EFFECT_HINT_OPTIN
+		&& !(cost_cap > 0 && effects[id]->cost > cost_cap))
+		enabled[id] = 1;
+}
+
+void effect_list(void)
+{
+	for(int id = 1; id <= count; id++)
+		printf("%c%2d %-12s cost %d%s%s%s%s%s%s\n", enabled[id] ? ' ' : '-', id,
+			effects[id]->name, effects[id]->cost,
+			effects[id]->hints & EFFECT_HINT_FULLFRAME ? " fullframe" : "",
+			effects[id]->hints & EFFECT_HINT_SLEEPS ? " sleeps" : "",
+			effects[id]->hints & EFFECT_HINT_STACK ? " stack" : "",
+			effects[id]->hints & EFFECT_HINT_PARTICLES ? " particles" : "",
+			effects[id]->hints & EFFECT_HINT_ERASES ? " erases" : "",
+			effects[id]->hints & EFFECT_HINT_OPTIN ? " opt-in" : "");
+}
+
+int effect_set(const char* spec)
+{
+	const char* dot = strchr(spec, '.');
+	const char* eq = strchr(spec, '=');
+	if(!dot || !eq || dot > eq || dot == spec || eq == dot + 1
+		|| strlen(spec) >= sizeof(params[0]) || num_params == MAX_PARAMS)
+	{
+		printf("Invalid effect option %s, expected Effect.key=value\n", spec);
+		return -1;
+	}
+	strcpy(params[num_params++], spec);
+	return 0;
+}
+
+const char* effect_param(int id, const char* key, const char* def)
+{
+	const effect_t* e = effect_get(id);
+	if(!e)
+		return def;
+	size_t name = strlen(e->name);
+	size_t len = strlen(key);
+	for(int i = num_params - 1; i >= 0; i--)
+	{
+		const char* p = params[i];
+		if(!strncmp(p, e->name, name) && p[name] == '.' && !strncmp(p + name + 1, key, len) && p[name + 1 + len] == '=')
+			return p + name + 2 + len;
+	}
+	return def;
+}
+
+//per-effect random stream: virtual thread id in the low byte, restart count above
+uint64_t EffectStream(int id)
+{
+	static uint32_t runs[MAX_EFFECTS + 1];
+	return ((uint64_t)__atomic_fetch_add(&runs[id], 1, __ATOMIC_RELAXED) << 8) | id;
+}
+
+static effect_ctx_t* EffectCreate(int id)
+{
+	const effect_t* e = effects[id];
+	effect_ctx_t* ctx = objpool_get(&ctx_pool);
+	ctx->state = objpool_get(&state_pool[id]);
+	ctx->img = compose_layer(id) ? compose_layer(id) : effect_img;
+	ctx->id = id;
+	ctx->scratch = arena_thread(); //EffectRun switches to its own worker's
+	rng_init(&ctx->rng, EffectStream(id));
+	if(e->init)
+		e->init(ctx);
+	return ctx;
+}
+
+static void EffectDestroy(effect_ctx_t* ctx)
+{
+	if(effects[ctx->id]->teardown)
+		effects[ctx->id]->teardown(ctx);
+	objpool_put(&state_pool[ctx->id], ctx->state);
+	objpool_put(&ctx_pool, ctx);
+}
+
+typedef struct
+{
+	int id;
+	int gen;         //stop generation at effect_start time
+	uint64_t ticket; //lockstep turn
+} effect_run_t;
+
+//lockstep: ends this instance's turn, unless it waits for its first, and
+//waits for the next
+static void EffectPark(uint64_t ticket, int ended)
+{
+	pthread_mutex_lock(&step_lock);
+	if(ended)
+	{
+		serving = 0;
+		pthread_cond_signal(&step_done);
+	}
+	while(serving != ticket)
+		pthread_cond_wait(&step_next, &step_lock);
+	pthread_mutex_unlock(&step_lock);
+}
+
+//lockstep: gives up the turn for good
+static void EffectLeave(uint64_t ticket)
+{
+	pthread_mutex_lock(&step_lock);
+	for(int i = 0; i < num_turns; i++)
+		if(turns[i] == ticket)
+		{
+			memmove(turns + i, turns + i + 1, (num_turns - i - 1) * sizeof(turns[0]));
+			num_turns--;
+			break;
+		}
+	if(serving == ticket)
+	{
+		serving = 0;
+		pthread_cond_signal(&step_done);
+	}
+	pthread_mutex_unlock(&step_lock);
+}
+
+static void EffectPrepare(void* arg)
+{
+	int id = (int)(intptr_t)arg;
+	effect_ctx_t* ctx = EffectCreate(id);
+	pthread_mutex_lock(&prepare_lock);
+	if(prepared[id])
+		EffectDestroy(ctx); //lost the race against another prepare
+	else
+		prepared[id] = ctx;
+	pthread_mutex_unlock(&prepare_lock);
+}
+
+//polls until a tick or a step is due: runs the ticks the clock has moved on, at
+//most EFFECT_CATCHUP, steps when due, otherwise checks the signal and sleeps
+static void EffectRun(void* arg)
+{
+	effect_run_t run = *(effect_run_t*)arg;
+	free(arg);
+	int id = run.id;
+	const effect_t* e = effects[id];
+	effect_ctx_t* ctx;
+
+	if(lockstep)
+		EffectPark(run.ticket, 0); //nothing, not even init, before the first turn
+	pthread_mutex_lock(&prepare_lock);
+	ctx = prepared[id];
+	prepared[id] = NULL;
+	pthread_mutex_unlock(&prepare_lock);
+	if(!ctx)
+		ctx = EffectCreate(id);
+	ctx->scratch = arena_thread();
+
+	double t1 = 0;
+	double t2 = 0;
+	double t3 = -1; //the previous poll
+	double owed = 0; //effect time not ticked yet
+	uint64_t cost = governor_step_begin();
+	while(1)
+	{
+		t1 = GetTime();
+		if(e->tick)
+		{
+			owed += t3 < 0 ? 0 : t1 - t3;
+			t3 = t1;
+			ctx->diff = e->timestep;
+			for(int n = 0; n < EFFECT_CATCHUP && owed > e->timestep - DUE_SLACK; n++)
+			{
+				e->tick(ctx);
+				owed -= e->timestep;
+			}
+			if(owed > e->timestep - DUE_SLACK)
+				owed = fmod(owed, e->timestep); //stalled, slow down instead of piling up ticks
+			ctx->alpha = owed > 0 ? owed / e->timestep : 0;
+		}
+		ctx->diff = t1-t2;
+		if(ctx->diff > e->interval - DUE_SLACK)
+		{
+			TRACE_BEGIN(e->name);
+			int done = e->step(ctx);
+			draw_flush();
+			TRACE_END(e->name);
+			if(done)
+				break;
+			arena_reset(ctx->scratch);
+			governor_step_end(&cost);
+			t2 = GetTime();
+		} else {
+			ctx->signal = GetSignal();
+			if(ctx->signal == 255 + id)
+			{
+				PostFeedback(id, 1);
+				break;
+			}
+			if(__atomic_load_n(&stop_gen[id], __ATOMIC_ACQUIRE) != run.gen)
+				break; //effect_stop, nobody waits for feedback
+			if(WaitVisible())
+			{
+				t2 = t3 = GetTime(); //do not fast-forward over the pause
+				continue;
+			}
+			double wait = e->interval - ctx->diff;
+			if(e->tick && e->timestep - owed < wait)
+				wait = e->timestep - owed;
+			TRACE_BEGIN("sleep");
+			if(lockstep)
+				EffectPark(run.ticket, 1);
+			else
+				usleep((uint64_t)(wait * 1000000));
+			TRACE_END("sleep");
+		}
+	}
+	arena_reset(ctx->scratch);
+	EffectDestroy(ctx);
+	__atomic_sub_fetch(&running[id], 1, __ATOMIC_ACQ_REL); //the last one fades the layer out
+	if(lockstep)
+		EffectLeave(run.ticket);
+}
+
+void effect_setup(threadpool_t* pool, XImage* img)
+{
+	effect_pool = pool;
+	effect_img = img;
+}
+
+int effect_start(int id)
+{
+	if(!effect_enabled(id))
+		return 0;
+	effect_run_t* run = malloc(sizeof(*run));
+	ASSERT(run, "Out of memory!");
+	run->id = id;
+	run->gen = __atomic_load_n(&stop_gen[id], __ATOMIC_ACQUIRE);
+	run->ticket = 0;
+	if(lockstep)
+	{
+		pthread_mutex_lock(&step_lock);
+		if(num_turns == max_turns)
+		{
+			max_turns = max_turns ? max_turns * 2 : 16;
+			turns = realloc(turns, max_turns * sizeof(turns[0]));
+			ASSERT(turns, "Out of memory!");
+		}
+		run->ticket = turns[num_turns++] = next_ticket++;
+		pthread_mutex_unlock(&step_lock);
+	}
+	compose_attach(id);
+	__atomic_add_fetch(&running[id], 1, __ATOMIC_RELEASE);
+	int err = threadpool_add(effect_pool, &EffectRun, run, 0);
+	if(err)
+	{
+		__atomic_sub_fetch(&running[id], 1, __ATOMIC_RELEASE);
+		if(lockstep)
+			EffectLeave(run->ticket);
+		free(run);
+	} else
+		compose_show(id, 1);
+	return err;
+}
+
+void effect_stop(int id)
+{
+	if(id <= 0 || id > count)
+		return;
+	__atomic_add_fetch(&stop_gen[id], 1, __ATOMIC_RELEASE);
+	compose_show(id, 0);
+}
+
+int effect_running(int id)
+{
+	return id > 0 && id <= count ? __atomic_load_n(&running[id], __ATOMIC_ACQUIRE) : 0;
+}
+
+int effect_prepare(int id)
+{
+	//in lockstep the instance creates its state in its turn, in start order
+	if(!effect_enabled(id) || prepared[id] || lockstep)
+		return 0;
+	compose_attach(id);
+	return threadpool_add(effect_pool, &EffectPrepare, (void*)(intptr_t)id, 0);
+}
+
+void effect_lockstep(void)
+{
+	lockstep = 1;
+}
+
+//one instance at a time, so what they draw over each other, the random
+//streams they are given and the signals they see do not depend on timing
+void effect_advance(void)
+{
+	pthread_mutex_lock(&step_lock);
+	for(int i = 0; i < num_turns;)
+	{
+		uint64_t ticket = turns[i];
+		serving = ticket;
+		pthread_cond_broadcast(&step_next);
+		while(serving == ticket)
+			pthread_cond_wait(&step_done, &step_lock);
+		if(i < num_turns && turns[i] == ticket)
+			i++; //still running, otherwise the next one moved up
+	}
+	pthread_mutex_unlock(&step_lock);
+}
@@ -0,0 +1,97 @@
+#ifndef _EFFECT_H_
+#define _EFFECT_H_
+
+#include <X11/Xlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threadpool.h"
+#include "rng.h"
+#include "arena.h"
+
+/**
+ * Effect registry. Every effect is described by an effect_t and runs on
+ * a pool worker inside EffectRun(), which owns the timing, the shared
+ * signal and suspension. The effect only sees its context and state.
+ *
+ * Effect ids are registration order starting at 1, they double as the
+ * virtual thread ids of the signal protocol: signal 255 + id asks effect
+ * id to exit and PostFeedback(id, 1) reports that it did.
+ *
+ * Simulation and drawing are separate: tick advances the effect by a
+ * fixed timestep of effect time, as many ticks as the clock has moved
+ * on (at most EFFECT_CATCHUP per poll, a longer stall slows the effect
+ * down instead of piling up work), and step draws at its own interval.
+ * A step usually falls between two ticks, ctx->alpha says how far, so
+ * the effect can interpolate and motion does not depend on load.
+ * In lockstep (export) the instances run one at a time, each up to its
+ * next sleep, so the output depends on the seed alone.
+ *
+ * Plugins are shared objects exporting EFFECT_PLUGIN_ENTRY, which calls
+ * effect_register() for each effect it provides.
+ */
+
+#define EFFECT_ABI 2
+#define MAX_EFFECTS 32
+#define MAX_PARAMS 64
+#define EFFECT_PLUGIN_ENTRY "bg_plugin_init"
+#define EFFECT_CATCHUP 5 //ticks per poll at most
+
+//resource hints
+#define EFFECT_HINT_FULLFRAME 1 //a single step may touch every pixel
+#define EFFECT_HINT_SLEEPS    2 //blocks inside step, keeps its worker busy
+#define EFFECT_HINT_STACK     4 //deep recursion, needs a full size stack
+#define EFFECT_HINT_PARTICLES 8 //draws from its particle pool, see particle.h
+#define EFFECT_HINT_ERASES    16 //draws black to clear what the others drew, see compose.h
+#define EFFECT_HINT_OPTIN     32 //off unless --effects or a timeline names it
+#define EFFECT_HINT_MOVING    64 //may keep particle velocities, see particle_velocities()
+
+typedef struct effect_ctx {
+	rng_t rng;       //private stream, see EffectStream()
+	XImage* img;
+	void* state;     //state_size bytes, zeroed before init
+	int id;
+	int signal;      //shared signal as of the last poll
+	double diff;     //seconds since the previous step, the timestep inside tick
+	double alpha;    //step: fraction of a timestep since the last tick
+	arena_t* scratch; //the worker's arena, reset after every step
+} effect_ctx_t;
+
+typedef struct effect {
+	int abi;         //EFFECT_ABI
+	const char* name;
+	size_t state_size;
+	double interval; //seconds between steps
+	double timestep; //seconds of effect time per tick
+	int cost;        //relative cost per step, 1 = cheapest
+	int hints;
+	const char* next; //effect started when this one exits, or NULL
+	void (*init)(effect_ctx_t* ctx);
+	void (*tick)(effect_ctx_t* ctx); //optional, every timestep
+	int (*step)(effect_ctx_t* ctx);  //nonzero ends the effect
+	void (*teardown)(effect_ctx_t* ctx); //optional
+} effect_t;
+
+int effect_register(const effect_t* desc); //returns the id or -1
+int effect_load(const char* path);          //dlopen a plugin, 0 on success
+void effect_register_builtin(void);
+
+int effect_count(void);
+int effect_find(const char* name);          //id or 0
+const effect_t* effect_get(int id);
+int effect_enable(const char* list, int max_cost); //comma separated names, NULL for all but the opt-in ones
+int effect_enabled(int id);
+void effect_opt_in(int id);                 //a timeline names it: enables EFFECT_HINT_OPTIN effects without --effects
+void effect_list(void);
+int effect_set(const char* spec);            //"Effect.key=value", 0 on success
+const char* effect_param(int id, const char* key, const char* def);
+
+void effect_setup(threadpool_t* pool, XImage* img);
+int effect_start(int id);                   //0 if started or disabled
+void effect_stop(int id);                   //every running instance exits at its next poll
+int effect_running(int id);                 //number of live instances
+int effect_prepare(int id);                 //init state on a worker, the next start picks it up; not in lockstep
+void effect_lockstep(void);                 //effects wait for effect_advance() instead of sleeping
+void effect_advance(void);                  //lockstep: every instance runs up to its next sleep, one after the other in start order
+uint64_t EffectStream(int id);
+
+#endif /* _EFFECT_H_ */
@@ -0,0 +1,615 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include "bg.h"
+#include "draw.h"
+#include "effect.h"
+#include "governor.h"
+#include "particle.h"
+#include "palette.h"
+#include "interact.h"
+#include "nbody.h"
+#include "stencil.h"
+#include "trace.h"
+
+#define LIGHTNING_BOLTS 1024
+#define LIGHTNING_SEGMENTS 32768 //segment pool, bolts beyond it wait for the next step
+#define LIGHTNING_DETAIL 5       //midpoint passes, a channel has 2^5 segments
+#define LIGHTNING_DEPTH 2        //forks of forks
+#define LIGHTNING_FORKS 16       //pending channels of one bolt
+
+#define RIPPLE_SPEED 0.25f  //squared wave speed in cells per step, stable below 0.5
+#define RIPPLE_DAMPING 0.995f
+#define RIPPLE_RATE 20      //one drop every RIPPLE_RATE ticks on average
+
+//motion per second of effect time, what the old per-poll updates gave on a typical machine
+#define CIRCLEFRAC_RATE 50000 //clock() units, it used to advance by its own CPU time
+#define GALAXY_RATE 900       //mean of the random advances
+#define PURGE_RATE 400        //ring growth in pixels, besides the widths drawn
+
+static void Scatter(rng_t* rng, struct particle* buf, int n)
+{
+	for(int i = 0; i<n; i++)
+	{
+		buf[i].direction = 2 * M_PI * rng_double(rng);
+		buf[i].speed = 0.08 * rng_double(rng);
+		buf[i].speed *= buf[i].speed;
+	}
+}
+
+//the effect's pool, scattered on its first run only; states keep it as first member
+static particle_pool_t* Particles(effect_ctx_t* ctx)
+{
+	particle_pool_t* pool = particle_acquire(ctx->id, effect_get(ctx->id)->name);
+	if(!(pool->ready & PARTICLE_READY))
+	{
+		Scatter(&ctx->rng, pool->buf, pool->count);
+		__atomic_store_n(&pool->ready, PARTICLE_READY, __ATOMIC_RELEASE); //read by the snapshot
+	}
+	return pool;
+}
+
+static void ParticlesTeardown(effect_ctx_t* ctx)
+{
+	particle_release(*(particle_pool_t**)ctx->state);
+}
+
+//a bolt strikes for ttl steps, redrawn with a fresh shape every step
+struct bolt_t
+{
+	int16_t x;
+	int16_t y;
+	int16_t len;
+	int16_t angle; //degrees
+	uint8_t age;
+	uint8_t ttl;
+};
+
+//a channel still to be generated: the main one or a fork
+struct fork
+{
+	float x;
+	float y;
+	float len;
+	int angle;
+	int level;
+};
+
+struct lightning
+{
+	struct bolt_t bolt[LIGHTNING_BOLTS];
+	draw_seg_t seg[LIGHTNING_SEGMENTS]; //refilled every step
+	int num_bolts;
+	int num_segs;
+};
+
+static float sin_lut[360];
+static pthread_once_t sin_once = PTHREAD_ONCE_INIT;
+
+static void SinInit(void)
+{
+	for(int i = 0; i < 360; i++)
+		sin_lut[i] = sinf(i * M_PI / 180);
+}
+
+static float Sin(int deg)
+{
+	return sin_lut[(deg % 360 + 360) % 360];
+}
+
+static float Cos(int deg)
+{
+	return Sin(deg + 90);
+}
+
+static void Strike(rng_t* rng, struct bolt_t* bolt)
+{
+	bolt->x = rng_range(rng, w);
+	bolt->y = rng_range(rng, h);
+	bolt->len = 40 + rng_range(rng, 200);
+	bolt->angle = rng_range(rng, 360);
+	bolt->age = 0;
+	bolt->ttl = 3 + rng_range(rng, 12);
+}
+
+//midpoint displacement: the ends are fixed, every pass moves the new midpoints
+//sideways by up to half as much as the pass before
+static void Channel(struct lightning* s, rng_t* rng, const struct fork* f, float bright,
+	struct fork* stack, int* top)
+{
+	float px[(1 << LIGHTNING_DETAIL) + 1], py[(1 << LIGHTNING_DETAIL) + 1];
+	int n = 1 << (LIGHTNING_DETAIL - f->level); //forks are shorter, fewer segments do
+	float nx = Sin(f->angle), ny = Cos(f->angle); //normal of (cos, -sin)
+	px[0] = f->x;
+	py[0] = f->y;
+	px[n] = f->x + f->len * Cos(f->angle);
+	py[n] = f->y - f->len * Sin(f->angle);
+	float off = f->len * 0.25f;
+	for(int step = n / 2; step >= 1; step /= 2, off *= 0.5f)
+		for(int i = step; i < n; i += 2 * step)
+		{
+			float d = off * (rng_double(rng) * 2 - 1);
+			px[i] = (px[i - step] + px[i + step]) / 2 + nx * d;
+			py[i] = (py[i - step] + py[i + step]) / 2 + ny * d;
+		}
+	uint32_t v = 255 * bright;
+	uint32_t color = 0xFF000000 | v << 16 | v << 8 | v;
+	for(int i = 0; i < n && s->num_segs < LIGHTNING_SEGMENTS; i++)
+	{
+		s->seg[s->num_segs++] = (draw_seg_t){px[i], py[i], px[i + 1], py[i + 1], color};
+		//about two forks per channel, shorter and off to one side
+		if(f->level < LIGHTNING_DEPTH && *top < LIGHTNING_FORKS && rng_range(rng, n) < 2)
+			stack[(*top)++] = (struct fork){px[i], py[i], f->len * (0.3f + 0.3f * rng_double(rng)),
+				f->angle + (rng_range(rng, 2) ? 1 : -1) * (15 + rng_range(rng, 30)), f->level + 1};
+	}
+}
+
+static void LightningInit(effect_ctx_t* ctx)
+{
+	struct lightning* s = ctx->state;
+	pthread_once(&sin_once, SinInit);
+	s->num_bolts = atoi(effect_param(ctx->id, "bolts", "0"));
+	if(s->num_bolts <= 0)
+		s->num_bolts = rng_range(&ctx->rng, 93) + 5;
+	if(s->num_bolts > LIGHTNING_BOLTS)
+		s->num_bolts = LIGHTNING_BOLTS;
+	for(int i=0; i<s->num_bolts; i++)
+	{
+		Strike(&ctx->rng, &s->bolt[i]);
+		s->bolt[i].age = rng_range(&ctx->rng, s->bolt[i].ttl); //not all at once
+	}
+}
+
+static int LightningStep(effect_ctx_t* ctx)
+{
+	struct lightning* s = ctx->state;
+	int active = governor_scale(s->num_bolts, 1);
+	struct fork stack[LIGHTNING_FORKS];
+	s->num_segs = 0;
+	for(int i=0; i<active && s->num_segs < LIGHTNING_SEGMENTS; i++)
+	{
+		struct bolt_t* bolt = &s->bolt[i];
+		if(++bolt->age > bolt->ttl)
+			Strike(&ctx->rng, bolt);
+		//fades over its life, every fork level is dimmer than its parent
+		float life = 1.0f - (float)bolt->age / (bolt->ttl + 1);
+		int top = 0;
+		stack[top++] = (struct fork){bolt->x, bolt->y, bolt->len, bolt->angle, 0};
+		while(top)
+		{
+			struct fork f = stack[--top];
+			float bright = life;
+			for(int l = 0; l < f.level; l++)
+				bright *= 0.55f;
+			Channel(s, &ctx->rng, &f, bright, stack, &top);
+		}
+	}
+	draw_segments(ctx->img, s->seg, s->num_segs);
+	return 0;
+}
+
+struct snowflake
+{
+	particle_pool_t* pool;
+	uint32_t color;
+};
+
+static void SnowFlakeInit(effect_ctx_t* ctx)
+{
+	struct snowflake* s = ctx->state;
+	s->color = 0xFFFFFFFF;
+	s->pool = Particles(ctx);
+}
+
+static void SnowFlakeTick(effect_ctx_t* ctx)
+{
+	struct snowflake* s = ctx->state;
+	struct particle* buf = s->pool->buf;
+	double diff = ctx->diff;
+	int n = governor_scale(s->pool->count, PARTICLE_MIN);
+	particle_remember(s->pool, n);
+	for(int i=0; i<n; i++)
+	{
+		buf[i].direction += (diff) * 0.000635;
+		buf[i].x += (buf[i].speed * cos(buf[i].direction)) * diff;
+		buf[i].y += (buf[i].speed * sin(buf[i].direction)) * diff;
+	}
+}
+
+static int SnowFlakeStep(effect_ctx_t* ctx)
+{
+	struct snowflake* s = ctx->state;
+	struct particle* buf = s->pool->buf;
+	int transition = 0;
+	int n = governor_scale(s->pool->count, PARTICLE_MIN);
+	for(int i=0; i<n; i++)
+	{
+		double px, py;
+		particle_at(s->pool, i, ctx->alpha, &px, &py);
+		int x = (px + 1) * (w/2);
+		int y = (py * (w/2)) + (h/2);
+		if (x < 0 || x >= w || y < 0 || y >= h)
+		{
+			transition++;
+			continue;
+		}
+		Plot(ctx->img, x, y, s->color);
+	}
+	if(transition > (int)((int64_t)n * 750 / 4096)) //about 18% left the screen
+	{
+		SetSignal(1); //ask CirclePurge to wipe
+		for(int i = 0; i<s->pool->count; i++)
+		{
+			buf[i].x = 0;
+			buf[i].y = 0;
+		}
+		particle_remember(s->pool, s->pool->count);
+		s->color = palette_lut()[rng_range(&ctx->rng, PALETTE_SIZE)];
+	}
+	return 0;
+}
+
+struct purge
+{
+	int i;
+	int x;
+	int y;
+	int limit;
+};
+
+static void CirclePurgeInit(effect_ctx_t* ctx)
+{
+	struct purge* s = ctx->state;
+	s->i = 10;
+	s->x = w/2;
+	s->y = h/2;
+	if(s->x > s->y)
+		s->limit = s->x;
+	else
+		s->limit = s->y;
+}
+
+static void CirclePurgeTick(effect_ctx_t* ctx)
+{
+	struct purge* s = ctx->state;
+	s->i += (int)(PURGE_RATE * ctx->diff + 0.5);
+}
+
+static int CirclePurgeStep(effect_ctx_t* ctx)
+{
+	struct purge* s = ctx->state;
+	uint32_t color = 0;
+	if(ctx->signal == 1)
+	{
+		CircleFill(ctx->img, s->x, s->y, s->i, color);
+		goto lim;
+	}
+	int width = rng_range(&ctx->rng, governor_scale(10, 1));
+	for(int z = 0; z<width; z++)
+		Circle(ctx->img, s->x, s->y, s->i+z, color);
+	s->i += width;
+	lim:
+	if(s->i > s->limit+150) //accomodate the curve
+		s->i = 10;
+	return 0;
+}
+
+struct frac
+{
+	float x;
+	float y;
+	float radius;
+	uint32_t color;
+};
+
+//depth first like the recursion it replaces, the pending circles live in the step's scratch arena
+static void recCircle(arena_t* scratch, XImage* img, uint32_t color, float x, float y, float radius, float min)
+{
+	int depth = 1;
+	for(float r = radius; r > min; r /= 2)
+		depth++;
+	struct frac* stack = arena_alloc(scratch, sizeof(*stack) * (3 * depth + 1), 16);
+	int top = 0;
+	stack[top++] = (struct frac){x, y, radius, color};
+	while(top)
+	{
+		struct frac c = stack[--top];
+		Circle(img, c.x, c.y, c.radius, c.color);
+		draw_flush(); //the server backend shows it now, not when the step ends
+		TRACE_BEGIN("sleep");
+		usleep(1000);
+		TRACE_END("sleep");
+		if(c.radius > min)
+		{
+			float r = c.radius/2;
+			stack[top++] = (struct frac){c.x, c.y - r, r, c.color|5};
+			stack[top++] = (struct frac){c.x, c.y + r, r, c.color&15};
+			stack[top++] = (struct frac){c.x - r, c.y, r, c.color*2};
+			stack[top++] = (struct frac){c.x + r, c.y, r, c.color/2};
+		}
+	}
+}
+
+struct circlefrac
+{
+	particle_pool_t* pool;
+};
+
+static void CircleFracInit(effect_ctx_t* ctx)
+{
+	struct circlefrac* s = ctx->state;
+	s->pool = Particles(ctx);
+}
+
+static void CircleFracTick(effect_ctx_t* ctx)
+{
+	struct circlefrac* s = ctx->state;
+	struct particle* buf = s->pool->buf;
+	double mod = CIRCLEFRAC_RATE * ctx->diff;
+	int n = governor_scale(s->pool->count, PARTICLE_MIN);
+	particle_remember(s->pool, n);
+	for(int i = 0; i<n; i++)
+	{
+		buf[i].direction += (mod) * 0.000635;
+		buf[i].x += (buf[i].speed * cos(buf[i].direction)) * mod;
+		buf[i].y += (buf[i].speed * sin(buf[i].direction)) * mod;
+	}
+}
+
+static int CircleFracStep(effect_ctx_t* ctx)
+{
+	struct circlefrac* s = ctx->state;
+	const uint32_t* lut = palette_lut();
+
+	if(ctx->signal == 5)
+	{
+		//lower quality stops the recursion at bigger circles
+		recCircle(ctx->scratch, ctx->img, lut[rng_range(&ctx->rng, PALETTE_SIZE)],
+			rng_range(&ctx->rng, w), rng_range(&ctx->rng, h), rng_range(&ctx->rng, h) + 10,
+			8.0f * 1000 / governor_quality());
+		return 0;
+	}
+	int n = governor_scale(s->pool->count, PARTICLE_MIN);
+	for(int i=0; i<n; i++)
+	{
+		double px, py;
+		particle_at(s->pool, i, ctx->alpha, &px, &py);
+		int x = (px + 1) * (w/2);
+		int y = (py * (w/2)) + (h/2);
+		if (x < 0 || x >= w || y < 0 || y >= h)
+			continue;
+		Plot(ctx->img, x, y, lut[i & PALETTE_MASK]);
+	}
+	return 0;
+}
+
+struct galaxy
+{
+	particle_pool_t* pool; //scratch holds the per-step random mods
+	interact_t* interact;  //NULL for the plain spiral
+	nbody_t* nbody;        //Galaxy.mode=nbody, replaces the spiral
+	int entropy;
+};
+
+static void GalaxyReset(effect_ctx_t* ctx)
+{
+	struct galaxy* s = ctx->state;
+	for(int i = 0; i<s->pool->count; i++)
+	{
+		s->pool->buf[i].x = 0;
+		s->pool->buf[i].y = 0;
+	}
+	Scatter(&ctx->rng, s->pool->buf, s->pool->count);
+	particle_remember(s->pool, s->pool->count);
+	s->entropy = 0;
+}
+
+//Galaxy.mode: radius, separation, cohesion, alignment on top of the spiral
+static const struct { const char* mode; interact_params_t prm; } galaxy_modes[] = {
+	{"flock", {0.02f, 0.5f, 0.01f, 0.05f}},
+	{"swarm", {0.03f, 0.3f, 0.03f, 0.0f}},
+	{"repel", {0.02f, 1.0f, 0.0f, 0.0f}},
+};
+
+static void GalaxyInit(effect_ctx_t* ctx)
+{
+	struct galaxy* s = ctx->state;
+	s->pool = Particles(ctx);
+	const char* mode = effect_param(ctx->id, "mode", "spiral");
+	size_t modes = sizeof(galaxy_modes) / sizeof(galaxy_modes[0]);
+	int known = !strcmp(mode, "spiral") || !strcmp(mode, "nbody");
+	for(size_t i = 0; i < modes; i++)
+		if(!strcmp(mode, galaxy_modes[i].mode))
+		{
+			s->interact = interact_create(s->pool->count, &galaxy_modes[i].prm);
+			known = 1;
+		}
+	if(!known)
+	{
+		printf("Unknown Galaxy.mode %s, one of: spiral nbody", mode);
+		for(size_t i = 0; i < modes; i++)
+			printf(" %s", galaxy_modes[i].mode);
+		printf("\n");
+	}
+	ASSERT(known, "Invalid Galaxy mode!");
+	if(!strcmp(mode, "nbody"))
+	{
+		nbody_params_t prm = {
+			.theta = atof(effect_param(ctx->id, "theta", "0.7")),
+			.dt = atof(effect_param(ctx->id, "dt", "0.0005")),
+			.centre_mass = 1,
+			.disc_mass = 0.5,
+		};
+		s->nbody = nbody_create(s->pool->count, &prm);
+		//a restart or a resumed snapshot carries on with the same disc
+		if(!(s->pool->ready & PARTICLE_MOVING))
+		{
+			nbody_seed(s->nbody, s->pool->buf, particle_velocities(s->pool), s->pool->count, &ctx->rng);
+			__atomic_or_fetch(&s->pool->ready, PARTICLE_MOVING, __ATOMIC_RELEASE);
+		}
+		particle_remember(s->pool, s->pool->count);
+	} else
+		__atomic_and_fetch(&s->pool->ready, ~PARTICLE_MOVING, __ATOMIC_RELEASE); //the spiral moves them without
+}
+
+static void GalaxyTeardown(effect_ctx_t* ctx)
+{
+	struct galaxy* s = ctx->state;
+	interact_destroy(s->interact);
+	nbody_destroy(s->nbody);
+	ParticlesTeardown(ctx);
+}
+
+static void GalaxyTick(effect_ctx_t* ctx)
+{
+	struct galaxy* s = ctx->state;
+	struct particle* buf = s->pool->buf;
+
+	if(ctx->signal == 2 && s->nbody)
+	{
+		nbody_seed(s->nbody, buf, particle_velocities(s->pool), s->pool->count, &ctx->rng); //chaos, a new galaxy
+		particle_remember(s->pool, s->pool->count);
+		PostFeedback(ctx->id, 0);
+		ctx->signal = 0;
+	}
+	if(ctx->signal == 2)
+	{
+		Scatter(&ctx->rng, buf, s->pool->count); //chaos, the end of galaxy
+		PostFeedback(ctx->id, 0);
+		ctx->signal = 0;
+		s->entropy++;
+		if(s->entropy > 5)
+			GalaxyReset(ctx);
+	}
+
+	int n = governor_scale(s->pool->count, PARTICLE_MIN);
+	particle_remember(s->pool, n);
+	if(s->nbody)
+	{
+		nbody_step(s->nbody, buf, particle_velocities(s->pool), n); //bodies past n hold still while the governor sheds them
+		return;
+	}
+	uint32_t* mods = s->pool->scratch;
+	rng_fill(&ctx->rng, mods, n, (uint32_t)(2 * GALAXY_RATE * ctx->diff) + 1);
+	for(int i = 0; i<n; i++)
+	{
+		int mod = mods[i];
+		buf[i].direction += (mod) * 0.000635;
+		buf[i].x += (buf[i].speed * cos(buf[i].direction)) * mod;
+		buf[i].y += (buf[i].speed * sin(buf[i].direction)) * mod;
+	}
+	if(s->interact)
+		interact_step(s->interact, buf, n);
+}
+
+static int GalaxyStep(effect_ctx_t* ctx)
+{
+	struct galaxy* s = ctx->state;
+	const uint32_t* lut = palette_lut();
+	int n = governor_scale(s->pool->count, PARTICLE_MIN);
+	for(int i=0; i<n; i++)
+	{
+		double px, py;
+		particle_at(s->pool, i, ctx->alpha, &px, &py);
+		int x = (px + 1) * (w/2);
+		int y = (py * (w/2)) + (h/2);
+		if (x < 0 || x >= w || y < 0 || y >= h)
+			continue;
+		Plot(ctx->img, x, y, lut[(i >> 4) & PALETTE_MASK]); //bands of 16 particles
+	}
+	return 0;
+}
+
+//wave equation on a stencil grid: field 0 is the surface, 1 the surface a step ago
+struct ripple
+{
+	stencil_t* grid;
+};
+
+static void RippleInit(effect_ctx_t* ctx)
+{
+	struct ripple* s = ctx->state;
+	int cells = atoi(effect_param(ctx->id, "cells", "320"));
+	cells = cells < 16 ? 16 : cells > STENCIL_MAX ? STENCIL_MAX : cells;
+	int rows = (int64_t)cells * h / w;
+	rows = rows < 1 ? 1 : rows > STENCIL_MAX ? STENCIL_MAX : rows;
+	s->grid = stencil_create(cells, rows, 2);
+}
+
+static void RippleTeardown(effect_ctx_t* ctx)
+{
+	struct ripple* s = ctx->state;
+	stencil_destroy(s->grid);
+}
+
+static void Wave(void* arg, const stencil_row_t* row)
+{
+	(void)arg;
+	float lap[STENCIL_TILE] __attribute__((aligned(16)));
+	stencil_laplace(row, 0, lap);
+	for(int x = 0; x < row->n; x += 4)
+	{
+		stencil_lanes_t u = stencil_load(row->src[0] + x);
+		stencil_lanes_t next = (2 * u - stencil_load(row->src[1] + x) + RIPPLE_SPEED * stencil_load(lap + x)) * RIPPLE_DAMPING;
+		stencil_store(row->dst[0] + x, next);
+		stencil_store(row->dst[1] + x, u);
+	}
+}
+
+//a raised bump, it spreads as a ring
+static void Drop(effect_ctx_t* ctx, stencil_t* grid)
+{
+	int gw = stencil_width(grid), gh = stencil_height(grid);
+	int r = 2 + rng_range(&ctx->rng, 3);
+	int cx = rng_range(&ctx->rng, gw), cy = rng_range(&ctx->rng, gh);
+	for(int y = cy - r; y <= cy + r; y++)
+		for(int x = cx - r; x <= cx + r; x++)
+		{
+			int d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+			if(x >= 0 && x < gw && y >= 0 && y < gh && d2 <= r * r)
+				*stencil_cell(grid, 0, x, y) += 1.5f * (1 - (float)d2 / (r * r));
+		}
+}
+
+static void RippleTick(effect_ctx_t* ctx)
+{
+	struct ripple* s = ctx->state;
+	if(!rng_range(&ctx->rng, RIPPLE_RATE))
+		Drop(ctx, s->grid);
+	stencil_step(s->grid, Wave, NULL);
+}
+
+static int RippleStep(effect_ctx_t* ctx)
+{
+	struct ripple* s = ctx->state;
+	stencil_render(s->grid, 0, ctx->img, 0.05f, 0.6f); //crests only, troughs stay transparent
+	return 0;
+}
+
+static const effect_t builtin[] = {
+	{EFFECT_ABI, "CircleFrac", sizeof(struct circlefrac), 0.01, 0.01, 4,
+		EFFECT_HINT_SLEEPS | EFFECT_HINT_PARTICLES, "Lightning",
+		CircleFracInit, CircleFracTick, CircleFracStep, ParticlesTeardown},
+	{EFFECT_ABI, "SnowFlake", sizeof(struct snowflake), 0.01, 0.02, 2, EFFECT_HINT_PARTICLES, NULL,
+		SnowFlakeInit, SnowFlakeTick, SnowFlakeStep, ParticlesTeardown},
+	{EFFECT_ABI, "Galaxy", sizeof(struct galaxy), 0.01, 0.02, 3, EFFECT_HINT_PARTICLES | EFFECT_HINT_MOVING, NULL,
+		GalaxyInit, GalaxyTick, GalaxyStep, GalaxyTeardown},
+	{EFFECT_ABI, "CirclePurge", sizeof(struct purge), 0.01, 0.01, 3,
+		EFFECT_HINT_FULLFRAME | EFFECT_HINT_ERASES, NULL,
+		CirclePurgeInit, CirclePurgeTick, CirclePurgeStep, NULL},
+	{EFFECT_ABI, "Lightning", sizeof(struct lightning), 0.01, 0, 1, 0, "CircleFrac",
+		LightningInit, NULL, LightningStep, NULL},
+	{EFFECT_ABI, "Ripple", sizeof(struct ripple), 0.03, 0.03, 3, EFFECT_HINT_FULLFRAME | EFFECT_HINT_OPTIN, NULL,
+		RippleInit, RippleTick, RippleStep, RippleTeardown},
+};
+
+//registration order is the virtual thread id the signals refer to
+void effect_register_builtin(void)
+{
+	for(size_t i = 0; i < sizeof(builtin) / sizeof(builtin[0]); i++)
+		ASSERT(effect_register(&builtin[i]) == (int)i + 1, "Failed effect_register");
+}
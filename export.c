@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include "bg.h"
+#include "export.h"
+#include "trace.h"
+#include "memory.h"
+
+typedef struct
+{
+	uint32_t* pixels; //packed copy of the canvas, converted to RGBA in place
+	uint8_t* planes;  //Y, U and V for y4m
+} export_slot_t;
+
+static int out = -1;
+static int splice_out = 0;
+static export_format_t format;
+static int width, height;
+static export_slot_t slots[EXPORT_SLOTS];
+static int64_t produced = 0; //frames handed to the writer
+static int64_t written = 0;  //frames fully written
+static int closing = 0;
+static int failed = 0;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+static uint64_t started;
+
+XImage* export_image(int w, int h)
+{
+	XImage* img = calloc(1, sizeof(XImage));
+	ASSERT(img, "Out of memory!");
+	img->width = w;
+	img->height = h;
+	img->format = ZPixmap;
+	img->byte_order = LSBFirst;
+	img->bitmap_unit = 32;
+	img->bitmap_bit_order = LSBFirst;
+	img->bitmap_pad = 32;
+	img->depth = 24;
+	img->bits_per_pixel = 32;
+	img->bytes_per_line = w * 4;
+	img->red_mask = 0xFF0000;
+	img->green_mask = 0x00FF00;
+	img->blue_mask = 0x0000FF;
+	ASSERT(XInitImage(img), "Unable to init export image!");
+	return img;
+}
+
+//0x00RRGGBB, the layout of export_image()
+static void ToRGBA(uint32_t* p, int n)
+{
+	for(int i = 0; i < n; i++)
+	{
+		uint32_t c = p[i];
+		p[i] = 0xFF000000 | (c & 0x00FF00) | (c >> 16 & 0xFF) | (c & 0xFF) << 16;
+	}
+}
+
+//BT.601 studio swing
+static void ToYUV(const uint32_t* p, uint8_t* planes, int n)
+{
+	uint8_t* y = planes;
+	uint8_t* u = planes + n;
+	uint8_t* v = planes + 2 * n;
+	for(int i = 0; i < n; i++)
+	{
+		int r = p[i] >> 16 & 0xFF;
+		int g = p[i] >> 8 & 0xFF;
+		int b = p[i] & 0xFF;
+		y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+		u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+		v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+	}
+}
+
+//writes every byte of the vector, 0 or -1
+static int WriteAll(struct iovec* iov, int n)
+{
+	while(n)
+	{
+		ssize_t done = splice_out ? vmsplice(out, iov, n, 0) : writev(out, iov, n);
+		if(done < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		while(n && (size_t)done >= iov->iov_len)
+		{
+			done -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if(n)
+		{
+			iov->iov_base = (char*)iov->iov_base + done;
+			iov->iov_len -= done;
+		}
+	}
+	return 0;
+}
+
+static void* ExportWriter(void* arg)
+{
+	(void)arg;
+	size_t n = (size_t)width * height;
+	static char frame_tag[] = "FRAME\n";
+	while(1)
+	{
+		pthread_mutex_lock(&ring_lock);
+		while(written == produced && !closing)
+			pthread_cond_wait(&ring_cond, &ring_lock);
+		if(written == produced)
+		{
+			pthread_mutex_unlock(&ring_lock);
+			break;
+		}
+		export_slot_t* slot = &slots[written % EXPORT_SLOTS];
+		pthread_mutex_unlock(&ring_lock);
+
+		struct iovec iov[4];
+		int parts;
+		TRACE_BEGIN("convert");
+		if(format == export_rgba)
+		{
+			ToRGBA(slot->pixels, n);
+			iov[0] = (struct iovec){slot->pixels, n * 4};
+			parts = 1;
+		} else {
+			ToYUV(slot->pixels, slot->planes, n);
+			iov[0] = (struct iovec){frame_tag, sizeof(frame_tag) - 1};
+			iov[1] = (struct iovec){slot->planes, n};
+			iov[2] = (struct iovec){slot->planes + n, n};
+			iov[3] = (struct iovec){slot->planes + 2 * n, n};
+			parts = 4;
+		}
+		TRACE_END("convert");
+		TRACE_BEGIN("write");
+		int err = WriteAll(iov, parts);
+		TRACE_END("write");
+
+		pthread_mutex_lock(&ring_lock);
+		if(err)
+		{
+			failed = 1;
+			produced = written; //nothing else goes out
+		} else
+			written++;
+		pthread_cond_broadcast(&ring_cond);
+		pthread_mutex_unlock(&ring_lock);
+		if(err)
+		{
+			perror("Export stopped");
+			break;
+		}
+	}
+	return NULL;
+}
+
+int export_open(const char* path, export_format_t fmt, int w, int h, int fps)
+{
+	if(!strcmp(path, "-"))
+	{
+		//the video owns stdout, messages go to stderr from here on
+		out = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	} else
+		out = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(out < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN); //a reader going away ends the export with EPIPE
+	format = fmt;
+	width = w;
+	height = h;
+
+	size_t n = (size_t)w * h;
+	for(int i = 0; i < EXPORT_SLOTS; i++)
+	{
+		slots[i].pixels = memory_frame(n * 4);
+		slots[i].planes = fmt == export_y4m ? memory_frame(n * 3) : NULL;
+	}
+
+	//vmsplice hands the pages to the pipe, once a whole frame went in
+	//after it the reader has consumed the frame before
+	struct stat st;
+	int pipe_size = fstat(out, &st) == 0 && S_ISFIFO(st.st_mode) ? fcntl(out, F_GETPIPE_SZ) : -1;
+	splice_out = pipe_size > 0 && (size_t)pipe_size <= n;
+
+	if(fmt == export_y4m)
+	{
+		char header[128];
+		int len = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", w, h, fps);
+		if(write(out, header, len) != len)
+		{
+			perror(path);
+			return -1;
+		}
+	}
+	started = GetTimerValue();
+	ASSERT(pthread_create(&writer, NULL, ExportWriter, NULL) == 0, "Unable to start export writer!");
+	return 0;
+}
+
+int export_frame(const XImage* img)
+{
+	pthread_mutex_lock(&ring_lock);
+	//a spliced slot is still referenced by the pipe until the next frame went in
+	while(!failed && produced - written >= EXPORT_SLOTS - splice_out)
+		pthread_cond_wait(&ring_cond, &ring_lock);
+	int err = failed;
+	export_slot_t* slot = &slots[produced % EXPORT_SLOTS];
+	pthread_mutex_unlock(&ring_lock);
+	if(err)
+		return -1;
+
+	for(int y = 0; y < height; y++)
+		memcpy(slot->pixels + (size_t)y * width, img->data + (size_t)y * img->bytes_per_line, (size_t)width * 4);
+
+	pthread_mutex_lock(&ring_lock);
+	produced++;
+	pthread_cond_broadcast(&ring_cond);
+	pthread_mutex_unlock(&ring_lock);
+	return 0;
+}
+
+void export_close(void)
+{
+	pthread_mutex_lock(&ring_lock);
+	closing = 1;
+	pthread_cond_broadcast(&ring_cond);
+	pthread_mutex_unlock(&ring_lock);
+	pthread_join(writer, NULL);
+	close(out);
+
+	double secs = (double)(GetTimerValue() - started) / 1000000;
+	double mb = (double)written * width * height * (format == export_y4m ? 3 : 4) / (1024 * 1024);
+	printf("Exported %lld frames in %.2lfs, %.1lf fps, %.1lf MiB/s%s\n", (long long)written, secs,
+		secs > 0 ? written / secs : 0, secs > 0 ? mb / secs : 0, splice_out ? " (vmsplice)" : "");
+	fflush(stdout);
+}
@@ -0,0 +1,24 @@
+#ifndef _EXPORT_H_
+#define _EXPORT_H_
+
+#include <X11/Xlib.h>
+
+/**
+ * Video export. Frames are streamed as raw RGBA or as YUV4MPEG2 (4:4:4)
+ * to a file or stdout ("-") without an X server. export_frame() copies
+ * the canvas into a ring slot and returns, a writer thread converts and
+ * writes the slot while the effects render the next frame. Slots go out
+ * with writev(), or vmsplice() when the output is a pipe no larger than
+ * a frame, so a slot is not reused before the reader has taken it.
+ */
+
+#define EXPORT_SLOTS 4
+
+typedef enum { export_rgba, export_y4m } export_format_t;
+
+XImage* export_image(int w, int h);  //32 bpp canvas without a display, data left NULL
+int export_open(const char* path, export_format_t format, int w, int h, int fps); //0 on success
+int export_frame(const XImage* img); //0, or -1 once the output is gone
+void export_close(void);             //drains the ring and reports the throughput
+
+#endif /* _EXPORT_H_ */
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "governor.h"
+
+#define WINDOW_NS 500000000ull
+#define OVER_LOAD 1.05
+#define UNDER_LOAD 0.75
+
+static double target_ns; //work per frame
+static double target_share; //percent of one CPU
+static int quality = 1000;
+static uint64_t step_ns;
+static uint64_t frame_ns;
+static uint64_t frames;
+static uint64_t window_start;
+static uint64_t window_cpu;
+static double load = 0;
+static int over, under;
+
+static uint64_t Now(clockid_t clk)
+{
+	struct timespec ts;
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void governor_init(double target_ms, double cpu_share)
+{
+	target_ns = target_ms * 1000000.0;
+	target_share = cpu_share;
+	window_start = Now(CLOCK_MONOTONIC);
+	window_cpu = Now(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+//thread cpu time, sleeps inside a step (recCircle) are not work
+uint64_t governor_step_begin(void)
+{
+	return Now(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void governor_step_end(uint64_t* begin)
+{
+	uint64_t now = Now(CLOCK_THREAD_CPUTIME_ID);
+	__atomic_add_fetch(&step_ns, now - *begin, __ATOMIC_RELAXED);
+	*begin = now;
+}
+
+uint64_t governor_frame_begin(void)
+{
+	return Now(CLOCK_MONOTONIC);
+}
+
+static void Evaluate(uint64_t now)
+{
+	uint64_t cpu = Now(CLOCK_PROCESS_CPUTIME_ID);
+	uint64_t steps = __atomic_exchange_n(&step_ns, 0, __ATOMIC_RELAXED);
+	double sample;
+
+	if(target_share > 0)
+		sample = (cpu - window_cpu) * 100.0 / (now - window_start) / target_share;
+	else
+		sample = (double)(steps + frame_ns) / frames / target_ns;
+	load = load ? load * 0.7 + sample * 0.3 : sample;
+
+	if(load > OVER_LOAD) {
+		over++;
+		under = 0;
+	} else if(load < UNDER_LOAD) {
+		under++;
+		over = 0;
+	} else
+		over = under = 0;
+
+	int q = quality;
+	if(over >= 2)
+	{
+		//proportional step down, at most halving
+		q = q * (load > 2 ? 0.5 : 1 / load);
+		over = 0;
+	} else if(under >= 4) {
+		q += 50;
+		under = 0;
+	}
+	if(q < GOVERNOR_MIN)
+		q = GOVERNOR_MIN;
+	if(q > 1000)
+		q = 1000;
+	if(q != quality)
+		printf("Quality %d%% (load %.2f)\n", q / 10, load);
+	__atomic_store_n(&quality, q, __ATOMIC_RELAXED);
+
+	window_start = now;
+	window_cpu = cpu;
+	frame_ns = 0;
+	frames = 0;
+}
+
+//called from the main thread only
+void governor_frame_end(uint64_t begin)
+{
+	uint64_t now = Now(CLOCK_MONOTONIC);
+	if(target_ns <= 0 && target_share <= 0)
+		return;
+	frame_ns += now - begin;
+	frames++;
+	if(now - window_start >= WINDOW_NS)
+		Evaluate(now);
+}
+
+int governor_quality(void)
+{
+	return __atomic_load_n(&quality, __ATOMIC_RELAXED);
+}
+
+int governor_scale(int n, int min)
+{
+	n = (int)((int64_t)n * governor_quality() / 1000);
+	return n < min ? min : n;
+}
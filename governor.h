@@ -0,0 +1,27 @@
+#ifndef _GOVERNOR_H_
+#define _GOVERNOR_H_
+
+#include <stdint.h>
+
+/**
+ * Adaptive quality governor. Effects report the CPU time of every step,
+ * main reports how long presenting a frame took, and twice a second the
+ * load is compared against the target: either milliseconds of work per
+ * frame or a share of one CPU. Quality drops quickly when over budget
+ * and recovers slowly below a dead band, so it does not oscillate.
+ * Without a target quality stays at 1.
+ */
+
+#define GOVERNOR_MIN 100 //quality is kept in permille
+
+void governor_init(double target_ms, double cpu_share);
+
+uint64_t governor_step_begin(void);
+void governor_step_end(uint64_t* begin); //accounts the time since *begin and restarts it
+uint64_t governor_frame_begin(void);
+void governor_frame_end(uint64_t begin);
+
+int governor_quality(void);         //permille, GOVERNOR_MIN..1000
+int governor_scale(int n, int min); //n scaled by quality, never below min
+
+#endif /* _GOVERNOR_H_ */
@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "bg.h"
+#include "parallel.h"
+#include "interact.h"
+
+struct interact
+{
+	interact_params_t prm;
+	int capacity;
+	int side;        //grid is side x side cells
+	int cells;       //plus one bucket for everything outside the grid
+	float inv;       //cells per unit
+	uint32_t* cell;  //cell of every particle
+	uint32_t* hist;  //per chunk counts, then per chunk write offsets
+	uint32_t* start; //first sorted index of every cell, cells + 1
+	uint32_t* order; //sorted index -> particle
+	float* sx;       //sorted copies of position and heading
+	float* sy;
+	float* sc;
+	float* ss;
+	float* dx;       //per sorted index results
+	float* dy;
+	float* turn;
+	struct particle* p;
+	int n;
+};
+
+static void* Array(size_t count, size_t size)
+{
+	size_t bytes = (count * size + 63) & ~(size_t)63;
+	void* a = aligned_alloc(64, bytes);
+	ASSERT(a, "Out of memory!");
+	return memset(a, 0, bytes); //the padding must hold finite floats
+}
+
+interact_t* interact_create(int capacity, const interact_params_t* params)
+{
+	interact_t* it = calloc(1, sizeof(*it));
+	ASSERT(it, "Out of memory!");
+	it->prm = *params;
+	it->capacity = capacity;
+	it->side = (int)ceilf(2 * INTERACT_EXTENT / params->radius);
+	if(it->side > 1024)
+		it->side = 1024;
+	if(it->side < 1)
+		it->side = 1;
+	it->cells = it->side * it->side;
+	it->inv = it->side / (2 * INTERACT_EXTENT);
+	it->cell = Array(capacity, sizeof(uint32_t));
+	it->hist = Array((size_t)parallel_chunks(capacity, INTERACT_GRAIN) * (it->cells + 1), sizeof(uint32_t));
+	it->start = Array(it->cells + 2, sizeof(uint32_t));
+	it->order = Array(capacity, sizeof(uint32_t));
+	it->sx = Array(capacity + 4, sizeof(float)); //Query() reads groups of four
+	it->sy = Array(capacity + 4, sizeof(float));
+	it->sc = Array(capacity + 4, sizeof(float));
+	it->ss = Array(capacity + 4, sizeof(float));
+	it->dx = Array(capacity, sizeof(float));
+	it->dy = Array(capacity, sizeof(float));
+	it->turn = Array(capacity, sizeof(float));
+	return it;
+}
+
+void interact_destroy(interact_t* it)
+{
+	if(!it)
+		return;
+	free(it->cell);
+	free(it->hist);
+	free(it->start);
+	free(it->order);
+	free(it->sx);
+	free(it->sy);
+	free(it->sc);
+	free(it->ss);
+	free(it->dx);
+	free(it->dy);
+	free(it->turn);
+	free(it);
+}
+
+//-1 outside the grid
+static int Coord(const interact_t* it, double v)
+{
+	double c = (v + INTERACT_EXTENT) * it->inv;
+	return c >= 0 && c < it->side ? (int)c : -1;
+}
+
+static void Bin(void* arg, int chunk, int begin, int end)
+{
+	interact_t* it = arg;
+	uint32_t* hist = it->hist + (size_t)chunk * (it->cells + 1);
+	memset(hist, 0, (it->cells + 1) * sizeof(uint32_t));
+	for(int i = begin; i < end; i++)
+	{
+		int gx = Coord(it, it->p[i].x);
+		int gy = Coord(it, it->p[i].y);
+		uint32_t c = gx < 0 || gy < 0 ? (uint32_t)it->cells : (uint32_t)(gy * it->side + gx);
+		it->cell[i] = c;
+		hist[c]++;
+	}
+}
+
+static void Place(void* arg, int chunk, int begin, int end)
+{
+	interact_t* it = arg;
+	uint32_t* offset = it->hist + (size_t)chunk * (it->cells + 1);
+	for(int i = begin; i < end; i++)
+	{
+		uint32_t k = offset[it->cell[i]]++;
+		it->order[k] = i;
+		it->sx[k] = it->p[i].x;
+		it->sy[k] = it->p[i].y;
+		it->sc[k] = cosf(it->p[i].direction);
+		it->ss[k] = sinf(it->p[i].direction);
+	}
+}
+
+//four candidates at a time, the compiler keeps these in vector registers
+typedef float lanes_t __attribute__((vector_size(16)));
+typedef int32_t lanes_mask_t __attribute__((vector_size(16)));
+
+static inline lanes_t Load(const float* p)
+{
+	lanes_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline float Sum(lanes_t v)
+{
+	return v[0] + v[1] + v[2] + v[3];
+}
+
+static void Query(void* arg, int chunk, int begin, int end)
+{
+	(void)chunk;
+	interact_t* it = arg;
+	const interact_params_t* prm = &it->prm;
+	float r2 = prm->radius * prm->radius;
+	float near2 = r2 / 4; //separation falls off with the squared distance
+	const lanes_t one = {1, 1, 1, 1};
+	const lanes_mask_t lane = {0, 1, 2, 3};
+	for(int k = begin; k < end; k++)
+	{
+		float x = it->sx[k];
+		float y = it->sy[k];
+		uint32_t c = it->cell[it->order[k]];
+		int cx = c % it->side;
+		int cy = c / it->side;
+		int count = 0;
+		int scanned = 0;
+		if(c == (uint32_t)it->cells)
+			cy = -2; //outside, no neighbours
+		lanes_t sumx = {0}, sumy = {0}, sumc = {0}, sums = {0}, sepx = {0}, sepy = {0};
+		lanes_mask_t hits = {0};
+		for(int gy = cy - 1; gy <= cy + 1; gy++)
+		{
+			if(gy < 0 || gy >= it->side)
+				continue;
+			for(int gx = cx - 1; gx <= cx + 1; gx++)
+			{
+				if(gx < 0 || gx >= it->side || count >= INTERACT_NEIGHBOURS || scanned >= INTERACT_SCAN)
+					continue;
+				int g = gy * it->side + gx;
+				int first = it->start[g];
+				int last = it->start[g + 1];
+				if(last - first > INTERACT_SCAN - scanned)
+					last = first + INTERACT_SCAN - scanned;
+				scanned += last - first;
+				//no branches on the distance, most candidates miss; the
+				//arrays are padded so the last group may read past the end
+				for(int j = first; j < last; j += 4)
+				{
+					lanes_mask_t idx = lane + j;
+					lanes_t px = Load(it->sx + j);
+					lanes_t py = Load(it->sy + j);
+					lanes_t ox = x - px;
+					lanes_t oy = y - py;
+					lanes_t d2 = ox * ox + oy * oy;
+					lanes_mask_t hit = (d2 < r2) & (idx < last) & (idx != k);
+					lanes_t w = (lanes_t)(hit & (lanes_mask_t)one);
+					lanes_t push = (lanes_t)((hit & (d2 < near2)) & (lanes_mask_t)(near2 - d2));
+					hits -= hit;
+					sumx += w * px;
+					sumy += w * py;
+					sumc += w * Load(it->sc + j);
+					sums += w * Load(it->ss + j);
+					sepx += ox * push;
+					sepy += oy * push;
+				}
+				count = hits[0] + hits[1] + hits[2] + hits[3];
+			}
+		}
+		if(!count)
+		{
+			it->dx[k] = it->dy[k] = it->turn[k] = 0;
+			continue;
+		}
+		float inv = 1.0f / count;
+		it->dx[k] = prm->separation * Sum(sepx) / near2 + prm->cohesion * (Sum(sumx) * inv - x);
+		it->dy[k] = prm->separation * Sum(sepy) / near2 + prm->cohesion * (Sum(sumy) * inv - y);
+		//sine of the angle between our heading and the neighbours' mean
+		it->turn[k] = prm->alignment * (Sum(sums) * it->sc[k] - Sum(sumc) * it->ss[k]) * inv;
+	}
+}
+
+static void Apply(void* arg, int chunk, int begin, int end)
+{
+	(void)chunk;
+	interact_t* it = arg;
+	for(int k = begin; k < end; k++)
+	{
+		struct particle* p = &it->p[it->order[k]];
+		p->x += it->dx[k];
+		p->y += it->dy[k];
+		p->direction += it->turn[k];
+	}
+}
+
+void interact_step(interact_t* it, struct particle* p, int n)
+{
+	if(n > it->capacity)
+		n = it->capacity;
+	it->p = p;
+	it->n = n;
+	parallel_for(n, INTERACT_GRAIN, Bin, it);
+
+	//exclusive prefix over cells, chunks in order inside each cell
+	int chunks = parallel_chunks(n, INTERACT_GRAIN);
+	uint32_t at = 0;
+	for(int c = 0; c <= it->cells; c++)
+	{
+		it->start[c] = at;
+		for(int k = 0; k < chunks; k++)
+		{
+			uint32_t* h = it->hist + (size_t)k * (it->cells + 1) + c;
+			uint32_t count = *h;
+			*h = at;
+			at += count;
+		}
+	}
+	it->start[it->cells + 1] = at;
+
+	parallel_for(n, INTERACT_GRAIN, Place, it);
+	parallel_for(n, INTERACT_GRAIN, Query, it);
+	parallel_for(n, INTERACT_GRAIN, Apply, it);
+}
@@ -0,0 +1,37 @@
+#ifndef _INTERACT_H_
+#define _INTERACT_H_
+
+#include "particle.h"
+
+/**
+ * Particle interactions in O(n) per step. Every step the particles are
+ * binned into a uniform grid with cells as wide as the interaction
+ * radius (a parallel counting sort: per-chunk histograms, one prefix
+ * sum, per-chunk scatter), then each particle looks at the 3x3 cells
+ * around it, at most INTERACT_NEIGHBOURS neighbours out of INTERACT_SCAN
+ * candidates, so dense clumps stay cheap. Particles off the grid do not
+ * interact. Queries and updates are split across the pool with
+ * parallel_for(). Coordinates are the particle space of the effects,
+ * the grid covers -INTERACT_EXTENT..INTERACT_EXTENT on both axes.
+ */
+
+#define INTERACT_EXTENT 1.25f
+#define INTERACT_NEIGHBOURS 16
+#define INTERACT_SCAN 64 //candidates looked at per particle
+#define INTERACT_GRAIN 4096
+
+typedef struct interact_params
+{
+	float radius;
+	float separation; //push apart closer than half the radius
+	float cohesion;   //pull toward the neighbours' centre
+	float alignment;  //turn toward the neighbours' heading
+} interact_params_t;
+
+typedef struct interact interact_t;
+
+interact_t* interact_create(int capacity, const interact_params_t* params);
+void interact_destroy(interact_t* it);
+void interact_step(interact_t* it, struct particle* p, int n);
+
+#endif /* _INTERACT_H_ */
@@ -7,633 +7,645 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <limits.h>
 #include <math.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include "sys/time.h"
+#include "bg.h"
 #include "threadpool.h"
-
-#define DEBUG
-#ifdef DEBUG
-# define ASSERT(condition, message) \
-	do { \
-	if (! (condition)) \
-		{ \
-			printf("%s \n", message);\
-			printf("Assertion %s failed in, %s line: %d \n", #condition, __FILE__, __LINE__);\
-			char buf[10];					\
-			fgets(buf, 10, stdin); \
-			exit(1); \
-	} \
-	} while (0)
-#else
-# define ASSERT(condition, message) do { } while (0)
-#endif
+#include "rng.h"
+#include "visibility.h"
+#include "governor.h"
+#include "effect.h"
+#include "timeline.h"
+#include "particle.h"
+#include "arena.h"
+#include "palette.h"
+#include "snapshot.h"
+#include "export.h"
+#include "screens.h"
+#include "draw.h"
+#include "parallel.h"
+#include "present.h"
+#include "trace.h"
+#include "memory.h"
+#include "submit.h"
+#include "compose.h"
 
 static Display *dpy;
 static int screen;
 static Window root;
-static int w;
-static int h;
+int w;
+int h;
 static threadpool_t *pool[64];
-static int left = 0;
-static pthread_mutex_t lock;
+int left = 0;
+pthread_mutex_t lock;
 static uint64_t timer_offset;
 static Pixmap tmpPix;
+static GC replayGC; //server backend, its foreground changes every colour run
 
-void CircleFill(XImage* img, int32_t centreX, int32_t centreY, int32_t radius, uint32_t color);
-void Circle(XImage* img, int32_t centreX, int32_t centreY, int32_t radius, uint32_t color);
-int bhm_line(XImage* img, uint32_t color, int x1,int y1,int x2,int y2);
-void CircleFrac();
-void SnowFlake();
-void Galaxy();
-void CirclePurge();
-void Lightning();
-void Star();
-uint64_t GetTimerValue();
-double GetTime();
+#define MAX_CPUS 256
+#define MAX_STACK_KB (1 << 20) //1 GiB
+#define FRAME_NS 10000000 //100 fps
+#define VISIBILITY_NS 250000000
 
-int main(int argc, char *argv[])
-{
-	dpy = XOpenDisplay(NULL);
-	ASSERT(dpy, "Unable to open display!");
-	screen = DefaultScreen(dpy);
-	root = XRootWindow(dpy, screen);
-	ASSERT(root, "Unable to open root window!");
-	w = XDisplayWidth(dpy, screen);
-	h = XDisplayHeight(dpy, screen);
-
-	Visual* visual = DefaultVisual(dpy, screen);
-	char* data = (char*)malloc(w*h*4);
-	XImage* img = XCreateImage(dpy, visual, DefaultDepth(dpy,screen),
-					ZPixmap, 0, data, w, h, 32, 0);
+static int suspended = 0; //nobody can see the root, effects park in WaitVisible()
+static pthread_cond_t resume;
 
-	pthread_mutex_init(&lock, NULL);
-	pool[0] = threadpool_create(64, 16192, 0);
+static int event_fd = -1; //effects kick the main loop through this eventfd
+static char status[MAX_EFFECTS + 1];
+static double export_time = -1; //virtual clock of the export, GetTime() follows it
 
-	ASSERT(threadpool_add(pool[0], &CircleFrac, img, 0) == 0, "Failed threadpool_add");//1  order is crucial
-	ASSERT(threadpool_add(pool[0], &SnowFlake, img, 0) == 0, "Failed threadpool_add"); //2
-	ASSERT(threadpool_add(pool[0], &Galaxy, img, 0) == 0, "Failed threadpool_add");//3
-	ASSERT(threadpool_add(pool[0], &CirclePurge, img, 0) == 0, "Failed threadpool_add"); //4
-	ASSERT(threadpool_add(pool[0], &Lightning, img, 0) == 0, "Failed threadpool_add"); //5
-	timer_offset = GetTimerValue();
+int ParseCpuList(const char* str, int* cpus, int max);
+void HandleFeedback();
+void Choreograph(rng_t* rng);
+void Present(XImage* img);
+void SetSuspended(int state);
+int Export(XImage* img, int frames, int fps, int timeline, rng_t* rng);
 
-	tmpPix = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen));
+static void usage(const char* prog)
+{
+	printf("usage: %s [options]\n"
+		"  -t, --threads N     max pool workers (default: effects + online CPUs)\n"
+		"  -c, --cpus LIST     pin workers round-robin to CPUs, e.g. 2-5,7\n"
+		"  -s, --stack-kb N    worker stack size in KiB (default: system)\n"
+		"  -i, --idle-ms N     retire workers idle for N ms (default: 5000)\n"
+		"  -M, --lean          huge-page frames, small stacks and queue, print the budget\n"
+		"  -S, --seed N        random seed, runs with the same seed repeat\n"
+		"  -V, --no-suspend    keep rendering while the root window is hidden\n"
+		"  -1, --single-screen draw on the default screen only, not on every screen\n"
+		"  -O, --flat          effects draw into one shared image, no layers or fades\n"
+		"  -b, --backend NAME  raster (default) draws into an image uploaded every frame,\n"
+		"                      server sends the primitives for the X server to draw,\n"
+		"                      xcb draws like raster and submits frames asynchronously\n"
+		"  -r, --present MODE  clear (default) repaints the whole root every frame,\n"
+		"                      root keeps one published root pixmap, repaints changes\n"
+		"  -T, --target-ms MS  scale quality to hold MS of work per frame\n"
+		"  -C, --cpu-share P   scale quality to hold P percent of one CPU, not with -T\n"
+		"  -P, --plugin PATH   load effects from a shared object, repeatable\n"
+		"  -e, --effects LIST  run only these effects, e.g. SnowFlake,Galaxy\n"
+		"  -m, --max-cost N    run only effects with cost N or lower\n"
+		"  -o, --option E.K=V  effect option, e.g. Galaxy.mode=flock, repeatable\n"
+		"  -l, --list-effects  list registered effects and exit\n"
+		"  -L, --timeline FILE run the choreography from FILE instead of at random\n"
+		"  -n, --particles N   particles per effect (default: %d), EFFECT=N for one\n"
+		"  -p, --palette NAME  colour palette, NAME,SECONDS sets the cycle time\n"
+		"  -R, --snapshot FILE keep the frame and particles in FILE and resume from it,\n"
+		"                      FILE,SECONDS sets the sync interval (default: 5)\n"
+		"  -x, --export FILE   render without X and write the video to FILE, - for stdout\n"
+		"  -f, --format FMT    export as y4m (default) or rgba\n"
+		"  -g, --size WxH      export frame size (default: 1280x720)\n"
+		"  -F, --fps N         export frame rate (default: 30)\n"
+		"  -N, --frames N      export N frames, 0 until the reader goes away (default: 300)\n"
+		"  -h, --help          show this help\n", prog, PARTICLE_DEFAULT);
+}
 
-	double t1 = 0;
-	double t2 = 0;
-	double diff = 0;
-	uint64_t tick1 = 0;
-	uint64_t tick2 = 0;
-	int copy;
-	char status[64]; //64 threads is the max allowance.
-	memset(status, 0, sizeof(status));
-	//these threads will kick in later.
-	status[5] = 1;
+int main(int argc, char *argv[])
+{
+	static const struct option longopts[] = {
+		{"threads",  required_argument, 0, 't'},
+		{"cpus",     required_argument, 0, 'c'},
+		{"stack-kb", required_argument, 0, 's'},
+		{"idle-ms",  required_argument, 0, 'i'},
+		{"lean",     no_argument,       0, 'M'},
+		{"seed",     required_argument, 0, 'S'},
+		{"no-suspend", no_argument,     0, 'V'},
+		{"single-screen", no_argument,  0, '1'},
+		{"flat",     no_argument,       0, 'O'},
+		{"backend",  required_argument, 0, 'b'},
+		{"present",  required_argument, 0, 'r'},
+		{"target-ms", required_argument, 0, 'T'},
+		{"cpu-share", required_argument, 0, 'C'},
+		{"plugin",   required_argument, 0, 'P'},
+		{"effects",  required_argument, 0, 'e'},
+		{"max-cost", required_argument, 0, 'm'},
+		{"option",   required_argument, 0, 'o'},
+		{"list-effects", no_argument,   0, 'l'},
+		{"timeline", required_argument, 0, 'L'},
+		{"particles", required_argument, 0, 'n'},
+		{"palette",  required_argument, 0, 'p'},
+		{"snapshot", required_argument, 0, 'R'},
+		{"export",   required_argument, 0, 'x'},
+		{"format",   required_argument, 0, 'f'},
+		{"size",     required_argument, 0, 'g'},
+		{"fps",      required_argument, 0, 'F'},
+		{"frames",   required_argument, 0, 'N'},
+		{"help",     no_argument,       0, 'h'},
+		{0, 0, 0, 0}
+	};
+	static int cpus[MAX_CPUS];
+	threadpool_attr_t attr;
+	rng_t rng;
+	int monitor = 1;
+	int all_screens = 1;
+	int layers = 1;
+	int present = PRESENT_CLEAR;
+	int xcb = 0;
+	double target_ms = 0;
+	double cpu_share = 0;
+	const char* enable = NULL;
+	int max_cost = 0;
+	int list = 0;
+	const char* timeline = NULL;
+	const char* snapshot = NULL;
+	const char* export = NULL;
+	export_format_t format = export_y4m;
+	int export_w = 1280;
+	int export_h = 720;
+	int fps = 30;
+	int frames = 300;
+	int opt;
 
-	while(1)
+	effect_register_builtin();
+	threadpool_attr_init(&attr);
+	attr.queue_size = 64;
+	attr.idle_timeout_ms = 5000;
+	rng_seed(GetTimerValue());
+	while((opt = getopt_long(argc, argv, "t:c:s:i:MS:V1Ob:r:T:C:P:e:m:o:lL:n:p:R:x:f:g:F:N:h", longopts, NULL)) != -1)
 	{
-		t1 = GetTime();
-		tick1++;
-		diff = t1 - t2;
-		if(diff > 0.01f)
+		switch(opt)
 		{
-			XPutImage(dpy, tmpPix, DefaultGC(dpy,screen), img, 0, 0, 0, 0, w, h);
-			XSetWindowBackgroundPixmap(dpy, root, tmpPix);
-			XClearWindow(dpy, root);
-		} else {
-			pthread_mutex_lock(&lock);
-			copy = left;
-			pthread_mutex_unlock(&lock);
-			
-			if((char)copy == -1) //feedback signal
+			case 't':
+				attr.max_threads = atoi(optarg);
+				break;
+			case 'c':
+				attr.cpu_count = ParseCpuList(optarg, cpus, MAX_CPUS);
+				attr.cpus = cpus;
+				ASSERT(attr.cpu_count > 0, "Invalid cpu list!");
+				break;
+			case 's':
 			{
-				pthread_mutex_lock(&lock);
-				left = 0;
-				pthread_mutex_unlock(&lock);
-				//printf("0x%08x\n", copy);
-				//printf("0x%01x\n", *((uint8_t*)&copy+3));
-				if(*((uint8_t*)&copy+3) == 1 && *((uint8_t*)&copy+2) == 1)
-				{
-					printf("Thread 1 aborted, starting next algorithm. Time %lf\n", t1);
-					ASSERT(threadpool_add(pool[0], &Lightning, img, 0) == 0, "Failed threadpool_add"); //5
-					status[1] = 1;
-					status[5] = 0;
-				}
-				if(*((uint8_t*)&copy+3) == 5 && *((uint8_t*)&copy+2) == 1)
-				{
-					printf("Thread 5 aborted, starting next algorithm. Time %lf\n", t1);
-					ASSERT(threadpool_add(pool[0], &CircleFrac, img, 0) == 0, "Failed threadpool_add"); //1
-					status[5] = 1;
-					status[1] = 0;
-				}
-			} else if(copy == 1) {
-				 //wait for circle purge
-				tick2++;
-				if(tick2 > 1000)
-				{
-					pthread_mutex_lock(&lock);
-					left = 0;
-					pthread_mutex_unlock(&lock);
-				}
-			} else if(copy == 2) //stub for galaxy "end"
-				goto nop;
-			else if(copy == 3)
-			{
-				if(status[1] != 0)
-					goto new_signal; //force signal regeneration
-				pthread_mutex_lock(&lock);
-				left = 256; //set exit signal for thread 1
-				pthread_mutex_unlock(&lock);
-			} else if(copy == 4) {
-				if(status[5] != 0)
-					goto new_signal;
-				pthread_mutex_lock(&lock);
-				left = 260; //set exit signal for thread 5
-				pthread_mutex_unlock(&lock);
-			} else if(copy == 5) {
-				//stub for recursive circle in 'CircleFrag'
-				if(status[1] != 0)
-					goto new_signal;
-				goto nop;
-			} else {
-				nop:
-				if(tick2 < tick1)
-				{
-					tick2 = ((rand() % 10000) + 100);
-					tick2 += tick1;
-				} else {
-					if(tick1 == tick2)
-					{
-						new_signal:
-						pthread_mutex_lock(&lock);
-						left = (rand() % 6) + 1;
-						pthread_mutex_unlock(&lock);
-						tick2 = 0;
-					}
-				}
+				char* end;
+				long kb = strtol(optarg, &end, 10);
+				ASSERT(end != optarg && !*end && kb > 0 && kb <= MAX_STACK_KB
+					&& (size_t)kb * 1024 >= (size_t)PTHREAD_STACK_MIN, "Invalid stack size!");
+				attr.stack_size = (size_t)kb * 1024;
+				break;
 			}
-		usleep((uint64_t)(diff * 1000000)); //70 fps
-		continue;
+			case 'i':
+				attr.idle_timeout_ms = atoi(optarg);
+				break;
+			case 'M':
+				memory_lean(1);
+				break;
+			case 'S':
+				rng_seed(strtoull(optarg, NULL, 0));
+				break;
+			case 'V':
+				monitor = 0;
+				break;
+			case '1':
+				all_screens = 0;
+				break;
+			case 'O':
+				layers = 0;
+				break;
+			case 'b':
+				ASSERT(!strcmp(optarg, "raster") || !strcmp(optarg, "server") || !strcmp(optarg, "xcb"), "Invalid backend!");
+				draw_backend(strcmp(optarg, "server") ? DRAW_RASTER : DRAW_SERVER);
+				xcb = !strcmp(optarg, "xcb");
+				break;
+			case 'r':
+				ASSERT(!strcmp(optarg, "clear") || !strcmp(optarg, "root"), "Invalid present mode!");
+				present = strcmp(optarg, "root") ? PRESENT_CLEAR : PRESENT_ROOT;
+				break;
+			case 'T':
+				target_ms = atof(optarg);
+				break;
+			case 'C':
+				cpu_share = atof(optarg);
+				break;
+			case 'P':
+				effect_load(optarg);
+				break;
+			case 'e':
+				enable = optarg;
+				break;
+			case 'm':
+				max_cost = atoi(optarg);
+				break;
+			case 'o':
+				ASSERT(effect_set(optarg) == 0, "Invalid effect option!");
+				break;
+			case 'l':
+				list = 1;
+				break;
+			case 'L':
+				timeline = optarg;
+				break;
+			case 'n':
+				ASSERT(particle_config(optarg) == 0, "Invalid particle count!");
+				break;
+			case 'p':
+				ASSERT(palette_select(optarg) == 0, "Invalid palette!");
+				break;
+			case 'R':
+				snapshot = optarg;
+				break;
+			case 'x':
+				export = optarg;
+				break;
+			case 'f':
+				ASSERT(!strcmp(optarg, "y4m") || !strcmp(optarg, "rgba"), "Invalid export format!");
+				format = strcmp(optarg, "rgba") ? export_y4m : export_rgba;
+				break;
+			case 'g':
+				ASSERT(sscanf(optarg, "%dx%d", &export_w, &export_h) == 2 && export_w > 0 && export_h > 0,
+					"Invalid export size!");
+				break;
+			case 'F':
+				fps = atoi(optarg);
+				ASSERT(fps > 0, "Invalid frame rate!");
+				break;
+			case 'N':
+				frames = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
 		}
-		t2 = GetTime();
 	}
-	XCloseDisplay(dpy);
-	return 0;
-}
+	ASSERT(effect_enable(enable, max_cost) == 0, "Invalid effect list!");
+	//after the plugins, the timeline may name their effects
+	ASSERT(!timeline || timeline_load(timeline) == 0, "Invalid timeline!");
+	if(list)
+	{
+		effect_list();
+		palette_list();
+		return 0;
+	}
+	//every effect keeps a worker for its whole lifetime, one more for a transition
+	if(attr.max_threads == 0)
+	{
+		attr.max_threads = effect_count() + 1 + threadpool_cpu_count();
+		if(attr.max_threads > MAX_THREADS)
+			attr.max_threads = MAX_THREADS;
+	}
+	ASSERT(attr.max_threads > effect_count(), "Too few threads for the effects!");
+	int helpers = (attr.cpu_count ? attr.cpu_count : threadpool_cpu_count()) - 1;
+	memory_budget(&attr, effect_count(), helpers);
+	//before anything is printed, stdout may become the video
+	ASSERT(!export || export_open(export, format, export_w, export_h, fps) == 0, "Unable to open export!");
+	printf("Seed %llu\n", (unsigned long long)rng_get_seed());
+	rng_init(&rng, 0); //stream 0 drives the signals, effects use EffectStream()
+	trace_init();
 
-struct particle
-{
-	double x;
-	double y;
-	double speed;
-	double direction;
-};
+	XImage* img;
+	if(export)
+	{
+		draw_backend(DRAW_RASTER); //there is no server to draw
+		w = export_w;
+		h = export_h;
+		img = export_image(w, h);
+	} else {
+		dpy = XOpenDisplay(NULL);
+		ASSERT(dpy, "Unable to open display!");
+		screen = DefaultScreen(dpy);
+		root = XRootWindow(dpy, screen);
+		ASSERT(root, "Unable to open root window!");
+		w = XDisplayWidth(dpy, screen);
+		h = XDisplayHeight(dpy, screen);
 
-struct bolt_t
-{
-	uint16_t x;
-	uint16_t y;
-	uint16_t len;
-	uint16_t _len;
-	int x_comp;
-	int y_comp;
-	double angle;
-	int sx;
-	int sy;
-};
-
-void Lightning(XImage* img)
-{
-	int copy = 0;
-	double t1 = 0;
-	double t2 = 0;
-	double diff = 0;
-	int i = 0;
-	int transition = 0;
-	uint32_t color = 0xFFFFFFFF;
-	
-	struct bolt_t bolt[100];
-	int num_bolts = (rand() % 93) + 5;
-	
-	for(i=0; i<num_bolts; i++)
+		Visual* visual = DefaultVisual(dpy, screen);
+		img = XCreateImage(dpy, visual, DefaultDepth(dpy,screen),
+						ZPixmap, 0, NULL, w, h, 32, 0);
+		ASSERT(img, "Unable to create image!");
+	}
+	if(!snapshot || snapshot_open(snapshot, img) < 0)
+		img->data = memory_frame((size_t)img->bytes_per_line * h);
+
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&resume, NULL);
+	ASSERT(!(target_ms > 0 && cpu_share > 0), "--target-ms and --cpu-share exclude each other!");
+	governor_init(target_ms, cpu_share);
+	event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	pool[0] = threadpool_create_attr(&attr);
+	ASSERT(pool[0], "Failed threadpool_create");
+	//effects split their loops with the workers left over, the caller is one of the cpus
+	parallel_setup(pool[0], helpers);
+
+	palette_setup(img);
+	if(layers && !draw_server())
+		compose_open(img); //before any effect starts drawing
+	effect_setup(pool[0], img);
+	timer_offset = GetTimerValue();
+	if(export)
 	{
-		bolt[i].x = (rand() % w);
-		bolt[i].y = (rand() % h);
-		bolt[i].len = (rand() % 20)+1;
-		bolt[i]._len = 0;
-		bolt[i].angle = rand() % 360;
-		bolt[i].x_comp = bolt[i].len * cos(-bolt[i].angle*M_PI/180) + bolt[i].x;
-		bolt[i].y_comp = bolt[i].len * sin(-bolt[i].angle*M_PI/180) + bolt[i].y;
-		bolt[i].sx = (bolt[i].x_comp - bolt[i].x);
-		bolt[i].sy = (bolt[i].y_comp - bolt[i].y);
+		export_time = 0;
+		effect_lockstep();
 	}
+	if(timeline)
+		timeline_start(GetTime());
+	else
+		for(int id = 1; id <= effect_count(); id++)
+			ASSERT(effect_start(id) == 0, "Failed effect_start");
 
-	int x = 0;
-	int y = 0;
-	while(1)
+	if(export)
 	{
-		t1 = GetTime();
-		diff = t1-t2;
-		if(diff > 0.01f)
-		{
-			for(i=0; i<num_bolts; i++)
-			{
-				bolt[i].x += bolt[i].sx ;
-				bolt[i].y += bolt[i].sy ;
-				x = bolt[i].x;
-				y = bolt[i].y;
-				bolt[i]._len += bhm_line(img, color, x, y, x-bolt[i].sx, y-bolt[i].sy);
-				if(bolt[i]._len > bolt[i].len)
-				{
-					if (x < 0 || x >= w || y < 0 || y >= h)
-					{
-						bolt[i].x = rand() % w;
-						bolt[i].y = rand() % h;
-					} else {
-						bolt[i].x = x;
-						bolt[i].y = y;
-					}
-					bolt[i].len = (rand() % 20)+1;
-					bolt[i]._len = 0;
-					bolt[i].angle = rand() % 360;
-					bolt[i].x_comp = bolt[i].len * cos(-bolt[i].angle*M_PI/180) + bolt[i].x;
-					bolt[i].y_comp = bolt[i].len * sin(-bolt[i].angle*M_PI/180) + bolt[i].y;
-					bolt[i].sx = (bolt[i].x_comp - bolt[i].x);
-					bolt[i].sy = (bolt[i].y_comp - bolt[i].y);
-				}
-			}
-		} else {
-			pthread_mutex_lock(&lock);
-			copy = left;
-			pthread_mutex_unlock(&lock);
-			if(copy == 260)
-			{
-				pthread_mutex_lock(&lock);
-				left = -1;
-				*((char*)&left+3)=5;
-				*((char*)&left+2)=1;
-				pthread_mutex_unlock(&lock);
-				return;
-			}
-			usleep((uint64_t)(diff * 1000000));
-			continue;
-		}
-		t2 = GetTime();
+		memory_report(&attr);
+		return Export(img, frames, fps, timeline != NULL, &rng);
 	}
-	return;
-}
 
-void SnowFlake(XImage* img)
-{
-	int copy = 0;
-	double t1 = 0;
-	double t2 = 0;
-	double diff = 0;
-	int i = 0;
-	clock_t ticks;
-	int transition = 0;
-	uint32_t color = 0xFFFFFFFF;
-	
-	struct particle buf[4096];
-	
-	for(i = 0; i<4096; i++)
-		{
-		buf[i].direction = (2 * M_PI * rand()) / RAND_MAX;
-		buf[i].speed = (0.08 * rand()) / RAND_MAX;
-		buf[i].speed *= buf[i].speed;
-		}
-	
+	tmpPix = present_open(dpy, screen, present, xcb ? img : NULL);
+	if(draw_server())
+	{
+		//the pixmap keeps what was drawn, it starts from the image once
+		replayGC = XCreateGC(dpy, tmpPix, 0, NULL);
+		XPutImage(dpy, tmpPix, replayGC, img, 0, 0, 0, 0, w, h);
+		if(all_screens && ScreenCount(dpy) > 1)
+			printf("The server backend draws on the default screen only\n");
+	} else if(all_screens)
+		screens_open(dpy, img);
+	memory_report(&attr); //every frame buffer is allocated by now
+
+	//one fd per wake-up source: X connection, frame deadline, effect feedback
+	//and the visibility poll
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	int xfd = ConnectionNumber(dpy);
+	int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	int vfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	ASSERT(epfd >= 0 && tfd >= 0 && vfd >= 0 && event_fd >= 0, "Unable to create event loop fds!");
+	struct itimerspec frame = {{0, FRAME_NS}, {0, FRAME_NS}};
+	struct itimerspec stop = {{0, 0}, {0, 0}};
+	struct itimerspec poll = {{0, VISIBILITY_NS}, {0, VISIBILITY_NS}};
+	ASSERT(timerfd_settime(tfd, 0, &frame, NULL) == 0, "Unable to arm frame timer!");
+	if(monitor)
+	{
+		visibility_init(dpy, root);
+		for(int i = 0; all_screens && i < ScreenCount(dpy); i++)
+			if(i != screen)
+				visibility_init(dpy, RootWindow(dpy, i));
+		ASSERT(timerfd_settime(vfd, 0, &poll, NULL) == 0, "Unable to arm visibility timer!");
+	}
+	struct epoll_event ev = {0};
+	ev.events = EPOLLIN;
+	ev.data.fd = xfd;
+	ASSERT(epoll_ctl(epfd, EPOLL_CTL_ADD, xfd, &ev) == 0, "epoll_ctl failed");
+	ev.data.fd = tfd;
+	ASSERT(epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) == 0, "epoll_ctl failed");
+	ev.data.fd = event_fd;
+	ASSERT(epoll_ctl(epfd, EPOLL_CTL_ADD, event_fd, &ev) == 0, "epoll_ctl failed");
+	ev.data.fd = vfd;
+	ASSERT(epoll_ctl(epfd, EPOLL_CTL_ADD, vfd, &ev) == 0, "epoll_ctl failed");
+	int sfd = submit_fd(); //replies and errors of the xcb backend
+	ev.data.fd = sfd;
+	ASSERT(sfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev) == 0, "epoll_ctl failed");
+
+	//these threads will kick in later.
+	status[effect_find("Lightning")] = 1;
+
+	struct epoll_event events[5];
+	uint64_t count;
+	XEvent xev;
 	while(1)
 	{
-		ticks += clock();
-		t1 = GetTime();
-		diff = t1-t2;
-		if(diff > 0.01f)
+		trace_poll();
+		//XPending flushes our requests and reads events Xlib already
+		//buffered, which epoll would otherwise never report
+		while(XPending(dpy))
 		{
-			
-			for(i=0; i<4096; i++)
-			{
-				buf[i].direction += (diff) * 0.000635;
-				buf[i].x += (buf[i].speed * cos(buf[i].direction)) * diff;
-				buf[i].y += (buf[i].speed * sin(buf[i].direction)) * diff;
-					
-				int x = (buf[i].x + 1) * (w/2);
-				int y = (buf[i].y * (w/2)) + (h/2);
-				if (x < 0 || x >= w || y < 0 || y >= h)
-				{
-					transition++;
+			XNextEvent(dpy, &xev);
+			if(monitor)
+				visibility_event(&xev);
+		}
+		int n = epoll_wait(epfd, events, 5, -1);
+		for(int e = 0; e < n; e++)
+		{
+			int fd = events[e].data.fd;
+			if(fd == xfd)
+				continue; //drained at the top of the loop
+			else if(fd == sfd)
+				submit_poll();
+			else if(fd == tfd) {
+				if(read(tfd, &count, sizeof(count)) != sizeof(count))
 					continue;
-				}
-				XPutPixel(img, x, y, color);
-			}
-			if(transition > 750)
-			{
-				pthread_mutex_lock(&lock);
-				left = 1;
-				pthread_mutex_unlock(&lock); 	
-				for(i = 0; i<4096; i++)
-				{
-					buf[i].x = 0;
-					buf[i].y = 0;
-				}
-				unsigned char red = (unsigned char)((1 + sin(ticks * 0.0001)) * 128);
-				unsigned char green = (unsigned char)((1 + sin(ticks * 0.0002)) * 128);
-				unsigned char blue = (unsigned char)((1 + sin(ticks * 0.0003)) * 128);
-				unsigned char alpha = (unsigned char)((1 + sin(ticks * 0.0004)) * 128);
-				color = 0;
-				color+=blue;
-				color <<=8;
-				color+=green;
-				color <<=8;
-				color+=red;
-				color <<=8;
-				color +=alpha;
+				//missed expirations are dropped, there is only one frame to show
+				palette_update(GetTime());
+				uint64_t begin = governor_frame_begin();
+				TRACE_BEGIN("present");
+				Present(img);
+				TRACE_END("present");
+				governor_frame_end(begin);
+				TRACE_COUNTER("quality", governor_quality());
+				if(timeline)
+					timeline_tick(GetTime());
+				else
+					Choreograph(&rng);
+				snapshot_sync(GetTime());
+				arena_reset(arena_thread()); //frame scratch of the main thread
+			} else if(fd == event_fd) {
+				if(read(event_fd, &count, sizeof(count)) != sizeof(count))
+					continue;
+				HandleFeedback();
+			} else if(fd == vfd) {
+				if(read(vfd, &count, sizeof(count)) != sizeof(count))
+					continue;
+				int hidden = !visibility_check();
+				if(hidden == suspended)
+					continue; //no change
+				//hidden: stop the frame clock and park the effects,
+				//visible again: one full frame brings the root up to date
+				printf("%s rendering. Time %lf\n", hidden ? "Suspended" : "Resumed", GetTime());
+				SetSuspended(hidden);
+				timerfd_settime(tfd, 0, hidden ? &stop : &frame, NULL);
+				if(!hidden)
+					Present(img);
 			}
-			transition = 0;
-		} else {
-			pthread_mutex_lock(&lock);
-			copy = left;
-			pthread_mutex_unlock(&lock);
-			if(copy == 257) //random events index ranges to 255 max, so 257-255 = 2, which is our thread.
-			{
-				pthread_mutex_lock(&lock);
-				left = -1;
-				*((char*)&left+3)=2;
-				*((char*)&left+2)=1; // 1 = terminated thread
-				pthread_mutex_unlock(&lock);
-				return;
-			}	
-			usleep((uint64_t)(diff * 1000000));
-			continue;
 		}
-		t2 = GetTime();
 	}
-	return;
+	//not reached, a signal ends the process (trace_poll() in a trace build)
+}
+
+//reports a virtual thread to main: state 1 = terminated, 0 = dummy callback
+void PostFeedback(int thread, int state)
+{
+	uint64_t one = 1;
+	TRACE_LOCK(&lock);
+	left = -1;
+	*((char*)&left+3) = thread;
+	*((char*)&left+2) = state;
+	pthread_mutex_unlock(&lock);
+	if(write(event_fd, &one, sizeof(one)) != sizeof(one))
+		printf("Lost feedback from thread %d\n", thread);
 }
 
-void CirclePurge(XImage* img)
+//starts the successor of a terminated effect
+void HandleFeedback()
 {
-	double t1 = 0;
-	double t2 = 0;
-	double diff = 0;
-	int i = 10;
-	uint32_t color = 0;
-	
-	int x = w/2;
-	int y = h/2;
-	int limit;
 	int copy;
-	if(x > y)
-		limit = x;
-	else
-		limit = y;
-	
-	while(1)
+	TRACE_LOCK(&lock);
+	copy = left;
+	if((char)copy == -1) //feedback signal
+		left = 0;
+	pthread_mutex_unlock(&lock);
+	if((char)copy != -1)
+		return;
+	//printf("0x%08x\n", copy);
+	//printf("0x%01x\n", *((uint8_t*)&copy+3));
+	int thread = *((uint8_t*)&copy+3);
+	const effect_t* e = effect_get(thread);
+	if(*((uint8_t*)&copy+2) == 1 && e && e->next)
 	{
-		t1 = GetTime();
-		diff = t1-t2;
-		i++;
-		if(diff > 0.01f)
-		{
-			if(copy == 1)
-			{
-				CircleFill(img, x, y, i, color);
-				goto lim;
-			}
-			int width = rand() % 10;
-			for(int z = 0; z<width; z++)
-				Circle(img, x, y, i+z, color);
-			i += width;
-			lim:
-			if(i > limit+150) //accomodate the curve
-				i = 10;
-		} else {
-			pthread_mutex_lock(&lock);
-			copy = left;
-			pthread_mutex_unlock(&lock);
-			if(copy == 259)
-			{
-				pthread_mutex_lock(&lock);
-				left = -1;
-				*((char*)&left+3)=4;
-				*((char*)&left+2)=1; // 1 = terminated thread
-				pthread_mutex_unlock(&lock);
-				return;
-			}	
-			usleep((uint64_t)(diff * 1000000));
-			continue;
-		}
-		t2 = GetTime();
+		int next = effect_find(e->next);
+		printf("Thread %d aborted, starting next algorithm. Time %lf\n", thread, GetTime());
+		ASSERT(effect_start(next) == 0, "Failed effect_start");
+		status[thread] = 1;
+		status[next] = 0;
 	}
-	return;
 }
 
-void recCircle(XImage* img, uint32_t color, float x, float y, float radius)
+int GetSignal()
 {
-	Circle(img, x, y, radius, color);
-	usleep(1000);
-	if(radius > 8)
-	{
-		recCircle(img, color/2, x + radius/2, y, radius/2);
-		recCircle(img, color*2, x - radius/2, y, radius/2);
-		recCircle(img, color&15, x, y + radius/2, radius/2);
-		recCircle(img, color|5, x, y - radius/2, radius/2);
-	}
+	int copy;
+	TRACE_LOCK(&lock);
+	copy = left;
+	pthread_mutex_unlock(&lock);
+	return copy;
+}
+
+void SetSignal(int value)
+{
+	TRACE_LOCK(&lock);
+	left = value;
+	pthread_mutex_unlock(&lock);
+}
+
+//the other screens upload on their own threads meanwhile
+void Present(XImage* img)
+{
+	present_wait(); //the blend rewrites rows the uploader may still be reading
+	compose_frame(GetTime());
+	screens_kick();
+	if(draw_server())
+		draw_replay(dpy, tmpPix, replayGC);
+	present_frame(draw_server() ? NULL : img);
+	screens_wait();
+}
+
+void SetSuspended(int state)
+{
+	TRACE_LOCK(&lock);
+	suspended = state;
+	if(!state)
+		pthread_cond_broadcast(&resume);
+	pthread_mutex_unlock(&lock);
 }
 
-void CircleFrac(XImage* img)
+//blocks while suspended, returns 1 if it did so effects can reset their clocks
+int WaitVisible()
 {
-	int copy = 0;
-	double t1 = 0;
-	double t2 = 0;
-	double diff = 0;
-	int i = 0;
-	clock_t ticks = 0;
-	clock_t t3 = 0;
-	clock_t t4 = 0;
-	clock_t mod = 0;
-	
-	unsigned long val = 0;
-	struct particle buf[4096];
-	memset(buf, 0, sizeof(buf));
-	
-	for(i = 0; i<4096; i++)
+	int waited = 0;
+	TRACE_LOCK(&lock);
+	while(suspended)
 	{
-		buf[i].direction = (2 * M_PI * rand()) / RAND_MAX;
-		buf[i].speed = (0.08 * rand()) / RAND_MAX;
-		buf[i].speed *= buf[i].speed;
+		pthread_cond_wait(&resume, &lock);
+		waited = 1;
 	}
-	
-	while(1)
+	pthread_mutex_unlock(&lock);
+	return waited;
+}
+
+//offline rendering: the same per-frame work as the live loop on a virtual
+//clock, in ticks of about FRAME_NS so effects step at their usual rate
+int Export(XImage* img, int frames, int fps, int timeline, rng_t* rng)
+{
+	double frame_dt = 1.0 / fps;
+	int sub = (int)(frame_dt * 1000000000 / FRAME_NS);
+	if(sub < 1)
+		sub = 1;
+	uint64_t count;
+
+	status[effect_find("Lightning")] = 1;
+	for(int64_t f = 0; !frames || f < frames; f++)
 	{
-		t3 = clock();
-		ticks += t3;
-		t1 = GetTime();
-		diff = t1-t2;
-		mod = t3-t4;
-	
-		unsigned char red = (unsigned char)((1 + sin(ticks * 0.0001)) * 128);
-		unsigned char green = (unsigned char)((1 + sin(ticks * 0.0002)) * 128);
-		unsigned char blue = (unsigned char)((1 + sin(ticks * 0.0003)) * 128);
-	
-		if(diff < 1.0f)
-		{
-			for(i = 0; i<4096; i++)
-			{
-				buf[i].direction += (mod) * 0.000635;
-				buf[i].x += (buf[i].speed * cos(buf[i].direction)) * mod;
-				buf[i].y += (buf[i].speed * sin(buf[i].direction)) * mod;
-			}
-		}
-		
-		if(diff > 0.01f)
+		for(int s = 0; s < sub; s++)
 		{
-			if(copy == 5)
-			{
-				val+=blue;
-				val <<=8;
-				val+=green;
-				val <<=8;
-				val+=red;
-				val <<=8;	
-				recCircle(img, val, rand() % w, rand() % h, rand() % h + 10);
-				goto end;
-			}
-			for(i=0; i<4096; i++)
-			{
-				int x = (buf[i].x + 1) * (w/2);
-				int y = (buf[i].y * (w/2)) + (h/2);
-				if (x < 0 || x >= w || y < 0 || y >= h)
-					continue;
-				val+=blue;
-				val <<=8;
-				val+=green;
-				val <<=8;
-				val+=red;
-				val <<=8;
-				//	      val +=0xFF;
-				XPutPixel(img, x, y, val);
-			}
-			end:;
-		} else {
-			pthread_mutex_lock(&lock);
-			copy = left;
-			pthread_mutex_unlock(&lock);
-			if(copy == 256)
-			{
-				pthread_mutex_lock(&lock);
-				left = -1;
-				*((char*)&left+3)=1;
-				*((char*)&left+2)=1; // 1 = terminated thread
-				pthread_mutex_unlock(&lock);
-				return;
-			}	
-			usleep((uint64_t)(diff * 1000000));
-			t4 = clock();
-			continue;
+			//the effects are parked, they read it in their turns
+			double t = (double)(f * sub + s + 1) * frame_dt / sub;
+			__atomic_store(&export_time, &t, __ATOMIC_RELAXED);
+			effect_advance();
+			if(read(event_fd, &count, sizeof(count)) == sizeof(count))
+				HandleFeedback();
+			if(timeline)
+				timeline_tick(GetTime());
+			else
+				Choreograph(rng);
+			arena_reset(arena_thread());
 		}
-		t4 = clock();
-		t2 = GetTime();
+		palette_update(GetTime());
+		compose_frame(GetTime());
+		TRACE_BEGIN("export frame");
+		int err = export_frame(img);
+		TRACE_END("export frame");
+		if(err)
+			break;
+		TRACE_COUNTER("quality", governor_quality());
+		snapshot_sync(GetTime());
+		trace_poll();
 	}
-	return;
+	export_close();
+	return 0;
 }
 
-void Galaxy(XImage* img)
+//random signal generator, runs once per frame
+void Choreograph(rng_t* rng)
 {
-	struct particle buf[4096];
-	s:
-	int copy = 0;
-	double t1 = 0;
-	double t2 = 0;
-	double diff = 0;
-	int i = 0;
-	clock_t ticks;
-	int entropy = 0;
-	
-	unsigned long val = 0;
-	
-	for(i = 0; i<4096; i++)
-	{
-		buf[i].x = 0;
-		buf[i].y = 0;
-		buf[i].direction = (2 * M_PI * rand()) / RAND_MAX;
-		buf[i].speed = (0.08 * rand()) / RAND_MAX;
-		buf[i].speed *= buf[i].speed;
-	}
-	
-	while(1)
-	{
-		ticks += clock();
-		t1 = GetTime();
-		diff = t1-t2;
-			
-		unsigned char red = (unsigned char)((1 + sin(ticks * 0.0001)) * 128);
-		unsigned char green = (unsigned char)((1 + sin(ticks * 0.0002)) * 128);
-		unsigned char blue = (unsigned char)((1 + sin(ticks * 0.0003)) * 128);
-	
-		for(i = 0; i<4096; i++)
+	static uint64_t tick1 = 0;
+	static uint64_t tick2 = 0;
+	int frac = effect_find("CircleFrac");
+	int bolt = effect_find("Lightning");
+	int copy;
+
+	tick1++;
+	copy = GetSignal();
+
+	if((char)copy == -1) //feedback pending, the eventfd wakes us for it
+		return;
+	else if(copy == 1) {
+		 //wait for circle purge
+		tick2++;
+		if(tick2 > 1000)
 		{
-			int mod = rand() % 5;
-			buf[i].direction += (mod) * 0.000635;
-			buf[i].x += (buf[i].speed * cos(buf[i].direction)) * mod;
-			buf[i].y += (buf[i].speed * sin(buf[i].direction)) * mod;
+			TRACE_LOCK(&lock);
+			left = 0;
+			pthread_mutex_unlock(&lock);
 		}
-		
-		if(diff > 0.01f)
+	} else if(copy == 2) //stub for galaxy "end"
+		goto nop;
+	else if(copy == 3)
+	{
+		if(!effect_enabled(frac) || status[frac] != 0)
+			goto new_signal; //force signal regeneration
+		SetSignal(255 + frac); //set exit signal for CircleFrac
+	} else if(copy == 4) {
+		if(!effect_enabled(bolt) || status[bolt] != 0)
+			goto new_signal;
+		SetSignal(255 + bolt); //set exit signal for Lightning
+	} else if(copy == 5) {
+		//stub for recursive circle in 'CircleFrag'
+		if(status[frac] != 0)
+			goto new_signal;
+		goto nop;
+	} else {
+		nop:
+		if(tick2 < tick1)
 		{
-			for(i=0; i<4096; i++)
-			{
-				int x = (buf[i].x + 1) * (w/2);
-				int y = (buf[i].y * (w/2)) + (h/2);
-				if (x < 0 || x >= w || y < 0 || y >= h)
-					{
-					  continue;
-					}
-				
-				val+=blue;
-				val <<=8;
-				val+=green;
-				val <<=8;
-				val+=red;
-				val <<=8;
-				val +=0xFF;
-				XPutPixel(img, x, y, val);
-			}
-	 	} else {
-			pthread_mutex_lock(&lock);
-			copy = left;
-			pthread_mutex_unlock(&lock);
-			if(copy == 2)
+			tick2 = (rng_range(rng, 10000) + 100);
+			tick2 += tick1;
+		} else {
+			if(tick1 == tick2)
 			{
-				for(i = 0; i<4096; i++)
-				{
-					buf[i].direction = (2 * M_PI * rand()) / RAND_MAX; //chaos, the end of galaxy
-					buf[i].speed = (0.08 * rand()) / RAND_MAX;
-					buf[i].speed *= buf[i].speed;
-				}
-				pthread_mutex_lock(&lock);
-				left = -1;
-				*((char*)&left+3) = 3; //virtual thread id
-				*((char*)&left+2) = 0; //our task 0 = dummy callback	
+				new_signal:
+				TRACE_LOCK(&lock);
+				left = rng_range(rng, 6) + 1;
 				pthread_mutex_unlock(&lock);
-				entropy++;
-				if(entropy > 5)
-					goto s;
+				tick2 = 0;
 			}
-			if(copy == 258)
-			{
-				pthread_mutex_lock(&lock);
-				left = -1;
-				*((char*)&left+3)=3;
-				*((char*)&left+2)=1; // 1 = terminated thread
-				pthread_mutex_unlock(&lock);
-				return;
-			}		
-			usleep((uint64_t)(diff * 1000000));
-			continue;
 		}
-		t2 = GetTime();
 	}
-	return;
 }
 
 uint64_t GetTimerValue()
@@ -645,207 +657,42 @@ uint64_t GetTimerValue()
 
 double GetTime()
 {
+	double t;
+	__atomic_load(&export_time, &t, __ATOMIC_RELAXED);
+	if(t >= 0)
+		return t;
 	return (double)(GetTimerValue()-timer_offset) / 1000000;
 }
 
-void CircleFill(XImage* img, int32_t centreX, int32_t centreY, int32_t radius, uint32_t color)
-{
-	const int32_t diameter = (radius * 2);
-	
-	int32_t x = (radius - 1);
-	int32_t y = 0;
-	int32_t tx = 1;
-	int32_t ty = 1;
-	int32_t error = (tx - diameter);
-	
-	while (x >= y)
-	{
-		//  Each of the following renders an octant of the circle
-		if (!(centreX + x < 0 || centreX + x >= w || centreY - y < 0 || centreY - y >= h))
-		{
-			XPutPixel(img, centreX + x, centreY - y, 0x00FF00FF);
-			for(int i = centreX + x; i>centreX-1; i--)
-				XPutPixel(img, i, centreY - y, color);
-		}
-		if (!(centreX - x < 0 || centreX - x >= w || centreY + y < 0 || centreY + y >= h))
-		{
-			XPutPixel(img, centreX - x, centreY + y, color);
-			for(int i = centreX - x; i<centreX+1; i++)
-				XPutPixel(img, i, centreY + y, color);
-		}
-		if (!(centreX + x < 0 || centreX + x >= w || centreY + y < 0 || centreY + y >= h))
-		{
-			XPutPixel(img, centreX + x, centreY + y, color);
-			for(int i = centreX + x; i>centreX-1; i--)
-				XPutPixel(img, i, centreY + y, color);
-		}
-		if (!(centreX - x < 0 || centreX - x >= w || centreY - y < 0 || centreY - y >= h))
-		{
-		 	XPutPixel(img, centreX - x, centreY - y, color);
-			for(int i = centreX - x; i<centreX+1; i++)
-				XPutPixel(img, i, centreY - y, color);
-	 	}
-		if (!(centreX + y < 0 || centreX + y >= w || centreY - x < 0 || centreY - x >= h))
-		{			  	
-			XPutPixel(img, centreX + y, centreY - x, color);
-			for(int i = centreX + y; i>centreX-1; i--)
-				XPutPixel(img, i, centreY - x, color);
-		}
-		if (!(centreX - y < 0 || centreX - y >= w || centreY + x < 0 || centreY + x >= h))
-		{	
-			XPutPixel(img, centreX - y, centreY + x, color);
-			for(int i = centreX - y; i<centreX+1; i++)
-				XPutPixel(img, i, centreY + x, color);
-		}
-		if (!(centreX + y < 0 || centreX + y >= w || centreY + x < 0 || centreY + x >= h))
-		{	
-			XPutPixel(img, centreX + y, centreY + x, color);
-			for(int i = centreX + y; i>centreX-1; i--)
-				XPutPixel(img, i, centreY + x, color);
-		}
-		if (!(centreX - y < 0 || centreX - y >= w || centreY - x < 0 || centreY - x >= h))
-		{	
-			XPutPixel(img, centreX - y, centreY - x, color);
-			for(int i = centreX - y; i<centreX+1; i++)
-				XPutPixel(img, i, centreY - x, color);
-		}
-		if (error <= 0)
-		{
-			++y;
-			error += ty;
-			ty += 2;
-		}
-		if (error > 0)
-		{
-			--x;
-			tx += 2;
-			error += (tx - diameter);
-		}
-	}
-}
-
-void Circle(XImage* img, int32_t centreX, int32_t centreY, int32_t radius, uint32_t color)
-{
-	const int32_t diameter = (radius * 2);
-	int32_t x = (radius - 1);
-	int32_t y = 0;
-	int32_t tx = 1;
-	int32_t ty = 1;
-	int32_t error = (tx - diameter);
-
-	while (x >= y)
-	{
-		//  Each of the following renders an octant of the circle
-		if (!(centreX + x < 0 || centreX + x >= w || centreY - y < 0 || centreY - y >= h))
-			XPutPixel(img, centreX + x, centreY - y, color);
-		if (!(centreX - x < 0 || centreX - x >= w || centreY + y < 0 || centreY + y >= h))
-			XPutPixel(img, centreX - x, centreY + y, color);
-		if (!(centreX + x < 0 || centreX + x >= w || centreY + y < 0 || centreY + y >= h))
-			XPutPixel(img, centreX + x, centreY + y, color);
-		if (!(centreX - x < 0 || centreX - x >= w || centreY - y < 0 || centreY - y >= h))
-		 	XPutPixel(img, centreX - x, centreY - y, color);
-		if (!(centreX + y < 0 || centreX + y >= w || centreY - x < 0 || centreY - x >= h))
-			XPutPixel(img, centreX + y, centreY - x, color);
-		if (!(centreX - y < 0 || centreX - y >= w || centreY + x < 0 || centreY + x >= h))
-			XPutPixel(img, centreX - y, centreY + x, color);
-		if (!(centreX + y < 0 || centreX + y >= w || centreY + x < 0 || centreY + x >= h))
-			XPutPixel(img, centreX + y, centreY + x, color);
-		if (!(centreX - y < 0 || centreX - y >= w || centreY - x < 0 || centreY - x >= h))
-			XPutPixel(img, centreX - y, centreY - x, color);
-		if (error <= 0)
-		{
-			++y;
-			error += ty;
-			ty += 2;
-		}
-		if (error > 0)
-		{
-			--x;
-			tx += 2;
-			error += (tx - diameter);
-		}
-	}
-}
-
-int bhm_line(XImage* img, uint32_t color, int x1,int y1,int x2,int y2)
+//parses "0-3,6" style lists, returns number of cpus or -1
+int ParseCpuList(const char* str, int* cpus, int max)
 {
-	int x,y,dx,dy,dx1,dy1,px,py,xe,ye,i;
-	int pc = 0;
-	dx=x2-x1;
-	dy=y2-y1;
-	dx1=fabs(dx);
-	dy1=fabs(dy);
-	px=2*dy1-dx1;
-	py=2*dx1-dy1;
-	if(dy1<=dx1)
+	int n = 0;
+	char* end;
+	while(*str)
 	{
-		if(dx>=0)
-		{
-			x=x1;
-			y=y1;
-			xe=x2;
-		} else {
-			x=x2;
-			y=y2;
-			xe=x1;
-		}
-		if (!(x < 0 || x >= w || y < 0 || y >= h))
-		{
-			XPutPixel(img, x, y, color);
-			pc++;
-		}
-		for(i=0;x<xe;i++)
-		{
-			x=x+1;
-			if(px<0)
-				px=px+2*dy1;
-			else {
-				if((dx<0 && dy<0) || (dx>0 && dy>0))
-					y=y+1;
-				else
-					y=y-1;
-				px=px+2*(dy1-dx1);
-			}
-			if (!(x < 0 || x >= w || y < 0 || y >= h))
-			{
-				XPutPixel(img, x, y, color);
-				pc++;
-			}
-		}
-	} else {
-		if(dy>=0)
+		long a = strtol(str, &end, 10);
+		long b = a;
+		if(end == str || a < 0)
+			return -1;
+		if(*end == '-')
 		{
-			x=x1;
-			y=y1;
-			ye=y2;
-		} else {
-			x=x2;
-			y=y2;
-			ye=y1;
+			str = end + 1;
+			b = strtol(str, &end, 10);
+			if(end == str || b < a)
+				return -1;
 		}
-		if (!(x < 0 || x >= w || y < 0 || y >= h))
+		for(; a <= b; a++)
 		{
-			XPutPixel(img, x, y, color);
-			pc++;
-		}
-		for(i=0;y<ye;i++)
-		{
-			y=y+1;
-			if(py<=0)
-				py=py+2*dx1;
-			else {
-				if((dx<0 && dy<0) || (dx>0 && dy>0))
-					x=x+1;
-				else
-					x=x-1;
-				py=py+2*(dx1-dy1);
-			}
-			if (!(x < 0 || x >= w || y < 0 || y >= h))
-			{
-				XPutPixel(img, x, y, color);
-				pc++;
-			}
+			if(n == max)
+				return -1;
+			cpus[n++] = a;
 		}
+		if(*end == ',')
+			end++;
+		else if(*end)
+			return -1;
+		str = end;
 	}
-	return pc;
+	return n;
 }
@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "bg.h"
+#include "effect.h"
+#include "particle.h"
+#include "memory.h"
+
+static int lean = 0;
+static size_t frame_bytes = 0; //all frame buffers, for the report
+static size_t hugetlb_bytes = 0;
+static size_t thp_bytes = 0;
+
+void memory_lean(int on)
+{
+	lean = on;
+}
+
+int memory_is_lean(void)
+{
+	return lean;
+}
+
+static size_t Round(size_t bytes, size_t to)
+{
+	return (bytes + to - 1) & ~(to - 1);
+}
+
+//smaller buffers would be mostly padding
+static int Huge(size_t bytes)
+{
+	return lean && bytes >= MEMORY_HUGE;
+}
+
+void* memory_frame(size_t bytes)
+{
+	if(!Huge(bytes))
+	{
+		size_t size = Round(bytes, 4096);
+		void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		ASSERT(p != MAP_FAILED, "Out of memory!");
+		__atomic_add_fetch(&frame_bytes, size, __ATOMIC_RELAXED);
+		return p;
+	}
+	size_t size = Round(bytes, MEMORY_HUGE);
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(p != MAP_FAILED)
+	{
+		__atomic_add_fetch(&hugetlb_bytes, size, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&frame_bytes, size, __ATOMIC_RELAXED);
+		return p;
+	}
+	//no reserved huge pages: over-map, trim to 2 MiB alignment, ask for THP
+	char* raw = mmap(NULL, size + MEMORY_HUGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ASSERT(raw != MAP_FAILED, "Out of memory!");
+	char* aligned = (char*)Round((uintptr_t)raw, MEMORY_HUGE);
+	if(aligned > raw)
+		munmap(raw, aligned - raw);
+	munmap(aligned + size, raw + MEMORY_HUGE - aligned);
+	if(madvise(aligned, size, MADV_HUGEPAGE) == 0)
+		__atomic_add_fetch(&thp_bytes, size, __ATOMIC_RELAXED);
+	memset(aligned, 0, size); //fault it in now, as huge pages while they are free
+	__atomic_add_fetch(&frame_bytes, size, __ATOMIC_RELAXED);
+	return aligned;
+}
+
+void memory_frame_free(void* p, size_t bytes)
+{
+	if(!p)
+		return;
+	size_t size = Round(bytes, Huge(bytes) ? MEMORY_HUGE : 4096);
+	munmap(p, size);
+	__atomic_sub_fetch(&frame_bytes, size, __ATOMIC_RELAXED);
+}
+
+void memory_budget(threadpool_attr_t* attr, int effects, int helpers)
+{
+	if(!lean)
+		return;
+	if(!attr->stack_size)
+		attr->stack_size = MEMORY_STACK;
+	//a runner and a prepare per effect, a transition and the parallel_for helpers
+	attr->queue_size = 2 * effects + 2 + helpers;
+}
+
+static double MiB(size_t bytes)
+{
+	return bytes / (1024.0 * 1024.0);
+}
+
+void memory_report(const threadpool_attr_t* attr)
+{
+	if(!lean)
+		return;
+	size_t particles = 0;
+	for(int id = 1; id <= effect_count(); id++)
+	{
+		const effect_t* e = effect_get(id);
+		if(effect_enabled(id) && e->hints & EFFECT_HINT_PARTICLES)
+			particles += particle_pool_bytes(particle_count(e->name), e->hints & EFFECT_HINT_MOVING);
+	}
+	printf("Memory: frames %.1f MiB (%.1f hugetlb, %.1f THP), stacks %d x %zu KiB, queue %d tasks, particles %.1f MiB\n",
+		MiB(frame_bytes), MiB(hugetlb_bytes), MiB(thp_bytes), attr->max_threads, attr->stack_size / 1024,
+		attr->queue_size, MiB(particles));
+}
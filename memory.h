@@ -0,0 +1,28 @@
+#ifndef _MEMORY_H_
+#define _MEMORY_H_
+
+#include <stddef.h>
+#include "threadpool.h"
+
+/**
+ * Memory footprint mode for hosts running many sessions. Frame buffers
+ * come from memory_frame(): page aligned mappings, and in lean mode
+ * those of MEMORY_HUGE and more are 2 MiB aligned and backed by huge
+ * pages, from hugetlbfs when pages are reserved and transparent huge
+ * pages (madvise) otherwise, so the random writes of particle plotting
+ * stay within a few TLB entries.
+ * Lean mode also bounds worker stacks and sizes the task queue to the
+ * effects, and memory_report() prints the resulting budget.
+ */
+
+#define MEMORY_HUGE (2 << 20)
+#define MEMORY_STACK (256 * 1024) //worker stack in lean mode unless -s is given
+
+void memory_lean(int on);
+int memory_is_lean(void);
+void* memory_frame(size_t bytes);
+void memory_frame_free(void* p, size_t bytes);
+void memory_budget(threadpool_attr_t* attr, int effects, int helpers); //stack and queue for lean mode
+void memory_report(const threadpool_attr_t* attr);
+
+#endif /* _MEMORY_H_ */
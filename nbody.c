@@ -0,0 +1,385 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "bg.h"
+#include "parallel.h"
+#include "nbody.h"
+
+#define NBODY_STACK (3 * NBODY_LEVELS + 4) //pending nodes of one walk
+#define NBODY_GROUP 16                     //bodies sharing a walk
+#define NBODY_LIST 1024                    //sources gathered before they are applied
+
+typedef struct
+{
+	float x[NBODY_LIST + 4]; //padded to whole lanes
+	float y[NBODY_LIST + 4];
+	float m[NBODY_LIST + 4];
+	int count;
+} nbody_list_t;
+
+typedef struct
+{
+	float cx, cy;  //centre of mass
+	float mass;
+	float size;    //edge of the node's square
+	int first;     //first child node, or first sorted body of a leaf
+	int count;     //children, or bodies of a leaf
+	int leaf;
+} nbody_node_t;
+
+struct nbody
+{
+	nbody_params_t prm;
+	int capacity;
+	uint32_t* code;   //Morton code per body, then per sorted index
+	uint32_t* order;  //sorted index -> body
+	uint32_t* code2;  //radix sort buffers
+	uint32_t* order2;
+	float* sx;        //sorted positions
+	float* sy;
+	float* ax;        //per sorted index results
+	float* ay;
+	float* vel;       //the caller's x, y pairs per body
+	nbody_node_t* node;
+	int nodes;
+	int max_nodes;
+	float mass;       //of one body
+	struct particle* p;
+	int n;
+};
+
+static void* Array(size_t count, size_t size)
+{
+	size_t bytes = (count * size + 63) & ~(size_t)63;
+	void* a = aligned_alloc(64, bytes);
+	ASSERT(a, "Out of memory!");
+	return memset(a, 0, bytes);
+}
+
+nbody_t* nbody_create(int capacity, const nbody_params_t* params)
+{
+	nbody_t* nb = calloc(1, sizeof(*nb));
+	ASSERT(nb, "Out of memory!");
+	nb->prm = *params;
+	nb->capacity = capacity;
+	nb->code = Array(capacity, sizeof(uint32_t));
+	nb->order = Array(capacity, sizeof(uint32_t));
+	nb->code2 = Array(capacity, sizeof(uint32_t));
+	nb->order2 = Array(capacity, sizeof(uint32_t));
+	nb->sx = Array(capacity, sizeof(float));
+	nb->sy = Array(capacity, sizeof(float));
+	nb->ax = Array(capacity, sizeof(float));
+	nb->ay = Array(capacity, sizeof(float));
+	nb->max_nodes = capacity / 2 + 64; //grows in Build() when bodies crowd
+	nb->node = malloc(nb->max_nodes * sizeof(nbody_node_t));
+	ASSERT(nb->node, "Out of memory!");
+	return nb;
+}
+
+void nbody_destroy(nbody_t* nb)
+{
+	if(!nb)
+		return;
+	free(nb->code);
+	free(nb->order);
+	free(nb->code2);
+	free(nb->order2);
+	free(nb->sx);
+	free(nb->sy);
+	free(nb->ax);
+	free(nb->ay);
+	free(nb->node);
+	free(nb);
+}
+
+void nbody_seed(nbody_t* nb, struct particle* p, float* vel, int n, rng_t* rng)
+{
+	if(n > nb->capacity)
+		n = nb->capacity;
+	//surface density falling off linearly to the rim, the centre left to the core
+	const double rim = 0.6, core = 0.03;
+	for(int i = 0; i < n; i++)
+	{
+		double r = core + (rim - core) * (1 - sqrt(1 - rng_double(rng)));
+		double a = 2 * M_PI * rng_double(rng);
+		p[i].x = r * cos(a);
+		p[i].y = r * sin(a);
+	}
+	//circular speed from the mass inside each radius, the disc taken as a point
+	for(int i = 0; i < n; i++)
+	{
+		double r = sqrt(p[i].x * p[i].x + p[i].y * p[i].y);
+		double u = (r - core) / (rim - core);
+		double inside = nb->prm.centre_mass + nb->prm.disc_mass * u * (2 - u);
+		double v = sqrt(inside * r / (r * r + NBODY_SOFTENING * NBODY_SOFTENING));
+		vel[2 * i] = -p[i].y / r * v;
+		vel[2 * i + 1] = p[i].x / r * v;
+	}
+}
+
+static uint32_t Spread(uint32_t v)
+{
+	v &= 0xFFFF;
+	v = (v | v << 8) & 0x00FF00FF;
+	v = (v | v << 4) & 0x0F0F0F0F;
+	v = (v | v << 2) & 0x33333333;
+	v = (v | v << 1) & 0x55555555;
+	return v;
+}
+
+static uint32_t Cell(double v)
+{
+	const float scale = (1 << NBODY_LEVELS) / (2 * NBODY_EXTENT);
+	float c = (v + NBODY_EXTENT) * scale;
+	return c <= 0 ? 0 : c >= (1 << NBODY_LEVELS) - 1 ? (1 << NBODY_LEVELS) - 1 : (uint32_t)c;
+}
+
+static void Code(void* arg, int chunk, int begin, int end)
+{
+	(void)chunk;
+	nbody_t* nb = arg;
+	for(int i = begin; i < end; i++)
+		nb->code[i] = Spread(Cell(nb->p[i].x)) | Spread(Cell(nb->p[i].y)) << 1;
+}
+
+//LSD radix sort, 8 bits a pass; four passes leave the result in code and order
+static void Sort(nbody_t* nb)
+{
+	uint32_t *key = nb->code, *idx = nb->order, *key2 = nb->code2, *idx2 = nb->order2;
+	for(int i = 0; i < nb->n; i++)
+		idx[i] = i;
+	for(int shift = 0; shift < 32; shift += 8)
+	{
+		uint32_t count[257] = {0};
+		for(int i = 0; i < nb->n; i++)
+			count[(key[i] >> shift & 0xFF) + 1]++;
+		for(int b = 0; b < 256; b++)
+			count[b + 1] += count[b];
+		for(int i = 0; i < nb->n; i++)
+		{
+			uint32_t k = count[key[i] >> shift & 0xFF]++;
+			key2[k] = key[i];
+			idx2[k] = idx[i];
+		}
+		uint32_t* t = key; key = key2; key2 = t;
+		t = idx; idx = idx2; idx2 = t;
+	}
+}
+
+static void Gather(void* arg, int chunk, int begin, int end)
+{
+	(void)chunk;
+	nbody_t* nb = arg;
+	for(int k = begin; k < end; k++)
+	{
+		nb->sx[k] = nb->p[nb->order[k]].x;
+		nb->sy[k] = nb->p[nb->order[k]].y;
+	}
+}
+
+//first index in [begin, end) whose quadrant at this level is at least q
+static int Bound(const nbody_t* nb, int begin, int end, int shift, uint32_t q)
+{
+	while(begin < end)
+	{
+		int mid = (begin + end) / 2;
+		if((nb->code[mid] >> shift & 3) < q)
+			begin = mid + 1;
+		else
+			end = mid;
+	}
+	return begin;
+}
+
+//fills node at for the sorted bodies [begin, end); children are stored together
+static void Build(nbody_t* nb, int at, int begin, int end, int level, float size)
+{
+	nbody_node_t* node = &nb->node[at];
+	node->size = size;
+	if(end - begin <= NBODY_LEAF || level == NBODY_LEVELS)
+	{
+		float mx = 0, my = 0;
+		for(int k = begin; k < end; k++)
+		{
+			mx += nb->sx[k];
+			my += nb->sy[k];
+		}
+		node->leaf = 1;
+		node->first = begin;
+		node->count = end - begin;
+		node->mass = nb->mass * (end - begin);
+		node->cx = mx / (end - begin);
+		node->cy = my / (end - begin);
+		return;
+	}
+	int shift = 2 * (NBODY_LEVELS - 1 - level);
+	int split[5] = {begin, 0, 0, 0, end};
+	for(int q = 1; q < 4; q++)
+		split[q] = Bound(nb, split[q - 1], end, shift, q);
+	int count = 0;
+	for(int q = 0; q < 4; q++)
+		count += split[q + 1] > split[q];
+	if(nb->nodes + count > nb->max_nodes)
+	{
+		nb->max_nodes *= 2;
+		nb->node = realloc(nb->node, nb->max_nodes * sizeof(nbody_node_t));
+		ASSERT(nb->node, "Out of memory!");
+	}
+	int first = nb->nodes;
+	nb->nodes += count;
+	for(int q = 0, c = first; q < 4; q++)
+		if(split[q + 1] > split[q])
+			Build(nb, c++, split[q], split[q + 1], level + 1, size / 2);
+	node = &nb->node[at]; //the pool may have moved
+	float m = 0, mx = 0, my = 0;
+	for(int c = first; c < first + count; c++)
+	{
+		m += nb->node[c].mass;
+		mx += nb->node[c].mass * nb->node[c].cx;
+		my += nb->node[c].mass * nb->node[c].cy;
+	}
+	node->leaf = 0;
+	node->first = first;
+	node->count = count;
+	node->mass = m;
+	node->cx = mx / m;
+	node->cy = my / m;
+}
+
+//four sources at a time, the compiler keeps these in vector registers
+typedef float lanes_t __attribute__((vector_size(16)));
+
+static inline lanes_t Load(const float* p)
+{
+	lanes_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline float Sum(lanes_t v)
+{
+	return v[0] + v[1] + v[2] + v[3];
+}
+
+//pull of the listed sources on the bodies of a group
+static void Apply(nbody_t* nb, nbody_list_t* list, int begin, int end)
+{
+	const float eps2 = NBODY_SOFTENING * NBODY_SOFTENING;
+	//pad to whole lanes with massless sources
+	for(int j = list->count; j & 3; j++)
+		list->x[j] = list->y[j] = list->m[j] = 0;
+	for(int k = begin; k < end; k++)
+	{
+		float x = nb->sx[k], y = nb->sy[k];
+		lanes_t ax = {0}, ay = {0};
+		for(int j = 0; j < list->count; j += 4)
+		{
+			lanes_t ox = Load(list->x + j) - x;
+			lanes_t oy = Load(list->y + j) - y;
+			lanes_t r2 = ox * ox + oy * oy + eps2;
+			//the body itself is listed too, its offset is zero
+			lanes_t f;
+			for(int l = 0; l < 4; l++)
+				f[l] = 1 / (r2[l] * sqrtf(r2[l]));
+			f *= Load(list->m + j);
+			ax += ox * f;
+			ay += oy * f;
+		}
+		nb->ax[k] += Sum(ax);
+		nb->ay[k] += Sum(ay);
+	}
+	list->count = 0;
+}
+
+static inline void Source(nbody_t* nb, nbody_list_t* list, int begin, int end, float x, float y, float m)
+{
+	if(list->count == NBODY_LIST)
+		Apply(nb, list, begin, end);
+	list->x[list->count] = x;
+	list->y[list->count] = y;
+	list->m[list->count] = m;
+	list->count++;
+}
+
+//one walk per group of NBODY_GROUP bodies along the curve: a node is taken
+//whole when it is far enough from every point of the group's bounding box
+static void Force(void* arg, int chunk, int begin, int end)
+{
+	(void)chunk;
+	nbody_t* nb = arg;
+	const nbody_node_t* node = nb->node;
+	const float theta2 = nb->prm.theta * nb->prm.theta;
+	nbody_list_t list;
+	int stack[NBODY_STACK];
+	list.count = 0;
+	for(int g = begin; g < end; g += NBODY_GROUP)
+	{
+		int last = g + NBODY_GROUP < end ? g + NBODY_GROUP : end;
+		float x0 = nb->sx[g], x1 = x0, y0 = nb->sy[g], y1 = y0;
+		for(int k = g; k < last; k++)
+		{
+			x0 = fminf(x0, nb->sx[k]);
+			x1 = fmaxf(x1, nb->sx[k]);
+			y0 = fminf(y0, nb->sy[k]);
+			y1 = fmaxf(y1, nb->sy[k]);
+			//the core, softened wider so close passes stay bounded
+			float r2 = nb->sx[k] * nb->sx[k] + nb->sy[k] * nb->sy[k] + 4 * NBODY_SOFTENING * NBODY_SOFTENING;
+			float f = nb->prm.centre_mass / (r2 * sqrtf(r2));
+			nb->ax[k] = -nb->sx[k] * f;
+			nb->ay[k] = -nb->sy[k] * f;
+		}
+		int top = 0;
+		stack[top++] = 0;
+		while(top)
+		{
+			const nbody_node_t* t = &node[stack[--top]];
+			float dx = fmaxf(fmaxf(x0 - t->cx, t->cx - x1), 0);
+			float dy = fmaxf(fmaxf(y0 - t->cy, t->cy - y1), 0);
+			if(t->size * t->size < theta2 * (dx * dx + dy * dy))
+				Source(nb, &list, g, last, t->cx, t->cy, t->mass);
+			else if(t->leaf)
+				for(int j = t->first; j < t->first + t->count; j++)
+					Source(nb, &list, g, last, nb->sx[j], nb->sy[j], nb->mass);
+			else
+				for(int c = t->first; c < t->first + t->count; c++)
+					stack[top++] = c;
+		}
+		Apply(nb, &list, g, last);
+	}
+}
+
+static void Integrate(void* arg, int chunk, int begin, int end)
+{
+	(void)chunk;
+	nbody_t* nb = arg;
+	const float dt = nb->prm.dt;
+	for(int k = begin; k < end; k++)
+	{
+		int i = nb->order[k];
+		float* v = nb->vel + 2 * i;
+		v[0] += nb->ax[k] * dt;
+		v[1] += nb->ay[k] * dt;
+		nb->p[i].x += v[0] * dt;
+		nb->p[i].y += v[1] * dt;
+	}
+}
+
+void nbody_step(nbody_t* nb, struct particle* p, float* vel, int n)
+{
+	if(n > nb->capacity)
+		n = nb->capacity;
+	if(n < 1)
+		return;
+	nb->p = p;
+	nb->vel = vel;
+	nb->n = n;
+	nb->mass = nb->prm.disc_mass / n;
+	parallel_for(n, NBODY_GRAIN, Code, nb);
+	Sort(nb);
+	parallel_for(n, NBODY_GRAIN, Gather, nb);
+	nb->nodes = 1;
+	Build(nb, 0, 0, n, 0, 2 * NBODY_EXTENT);
+	parallel_for(n, NBODY_GRAIN, Force, nb);
+	parallel_for(n, NBODY_GRAIN, Integrate, nb);
+}
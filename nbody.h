@@ -0,0 +1,44 @@
+#ifndef _NBODY_H_
+#define _NBODY_H_
+
+#include "particle.h"
+#include "rng.h"
+
+/**
+ * Self-gravity in O(n log n) per step with the Barnes-Hut approximation.
+ * Every step the particles are sorted along a Morton curve (radix sort
+ * of the interleaved cell bits) and a quadtree is built over the sorted
+ * ranges, every node keeping its mass and centre of mass. A particle
+ * takes a whole node as one body when the node is smaller than theta
+ * times its distance, otherwise it opens it. Runs of bodies along the
+ * curve share one walk and sum the gathered sources in vector lanes;
+ * the runs are split across the pool with parallel_for(). Positions and
+ * velocities (x, y pairs, see particle_velocities()) belong to the
+ * caller; the integration is semi-implicit Euler with a fixed timestep.
+ * The tree
+ * covers -NBODY_EXTENT..NBODY_EXTENT, bodies further out are binned on
+ * its border but still attract with their real positions.
+ */
+
+#define NBODY_EXTENT 2.0f
+#define NBODY_LEVELS 16     //tree depth, Morton bits per axis
+#define NBODY_LEAF 8        //bodies summed directly in a leaf
+#define NBODY_SOFTENING 0.01f
+#define NBODY_GRAIN 2048
+
+typedef struct nbody_params
+{
+	float theta;       //opening angle, 0 is exact
+	float dt;          //timestep
+	float centre_mass; //fixed at the origin, holds the disc together
+	float disc_mass;   //shared by all bodies
+} nbody_params_t;
+
+typedef struct nbody nbody_t;
+
+nbody_t* nbody_create(int capacity, const nbody_params_t* params);
+void nbody_destroy(nbody_t* nb);
+void nbody_seed(nbody_t* nb, struct particle* p, float* vel, int n, rng_t* rng); //a rotating disc
+void nbody_step(nbody_t* nb, struct particle* p, float* vel, int n);
+
+#endif /* _NBODY_H_ */
@@ -0,0 +1,115 @@
+#include <X11/Xlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "palette.h"
+
+#define MAX_STOPS 8
+
+typedef struct
+{
+	const char* name;
+	double period; //default seconds per cycle
+	int stops;
+	uint32_t rgb[MAX_STOPS]; //0xRRGGBB, evenly spaced, the last blends into the first
+} palette_def_t;
+
+static const palette_def_t palettes[] = {
+	{"spectrum", 20, 6, {0xFF0000, 0xFFFF00, 0x00FF00, 0x00FFFF, 0x0000FF, 0xFF00FF}},
+	{"fire",     12, 5, {0x200000, 0xB01000, 0xFF6000, 0xFFD040, 0xFF8000}},
+	{"ice",      16, 4, {0x001040, 0x0060C0, 0x80E0FF, 0xFFFFFF}},
+	{"aurora",   24, 5, {0x00FF80, 0x00A0A0, 0x4020C0, 0xC040FF, 0x20FF40}},
+	{"mono",     10, 2, {0x404040, 0xFFFFFF}},
+};
+
+static const palette_def_t* current = &palettes[0];
+static double period = 0;             //0 = the palette's default
+static float gradient[PALETTE_SIZE][3]; //the unrotated palette
+static uint32_t lut[2][PALETTE_SIZE];
+static int front = 0;
+static struct { int shift; int bits; } channel[3];
+
+int palette_select(const char* spec)
+{
+	const char* comma = strchr(spec, ',');
+	size_t len = comma ? (size_t)(comma - spec) : strlen(spec);
+	for(size_t i = 0; i < sizeof(palettes) / sizeof(palettes[0]); i++)
+	{
+		if(strlen(palettes[i].name) != len || strncmp(palettes[i].name, spec, len))
+			continue;
+		current = &palettes[i];
+		period = comma ? atof(comma + 1) : 0;
+		return period < 0 ? -1 : 0;
+	}
+	printf("Unknown palette %.*s\n", (int)len, spec);
+	palette_list();
+	return -1;
+}
+
+void palette_list(void)
+{
+	printf("Palettes:");
+	for(size_t i = 0; i < sizeof(palettes) / sizeof(palettes[0]); i++)
+		printf(" %s", palettes[i].name);
+	printf("\n");
+}
+
+static void MaskChannel(unsigned long mask, int c)
+{
+	channel[c].shift = mask ? __builtin_ctzl(mask) : 16 - 8 * c;
+	channel[c].bits = mask ? __builtin_popcountl(mask) : 8;
+	if(channel[c].bits > 8)
+		channel[c].bits = 8;
+}
+
+void palette_setup(XImage* img)
+{
+	MaskChannel(img->red_mask, 0);
+	MaskChannel(img->green_mask, 1);
+	MaskChannel(img->blue_mask, 2);
+
+	const palette_def_t* p = current;
+	for(int i = 0; i < PALETTE_SIZE; i++)
+	{
+		float pos = (float)i * p->stops / PALETTE_SIZE;
+		int a = (int)pos;
+		float f = pos - a;
+		uint32_t ca = p->rgb[a];
+		uint32_t cb = p->rgb[(a + 1) % p->stops];
+		for(int c = 0; c < 3; c++)
+		{
+			int sh = 16 - 8 * c;
+			gradient[i][c] = ((ca >> sh) & 0xFF) * (1 - f) + ((cb >> sh) & 0xFF) * f;
+		}
+	}
+	palette_update(0);
+}
+
+void palette_update(double t)
+{
+	double cycle = period > 0 ? period : current->period;
+	double phase = fmod(t / cycle, 1.0) * PALETTE_SIZE;
+	int shift = (int)phase;
+	float f = phase - shift;
+	uint32_t* out = lut[front ^ 1];
+	for(int i = 0; i < PALETTE_SIZE; i++)
+	{
+		//rotated by a fraction of an entry, the cycle does not step
+		const float* a = gradient[(i + shift) & PALETTE_MASK];
+		const float* b = gradient[(i + shift + 1) & PALETTE_MASK];
+		uint32_t pixel = 0;
+		for(int c = 0; c < 3; c++)
+		{
+			uint32_t v = (uint32_t)(a[c] * (1 - f) + b[c] * f);
+			pixel |= (v >> (8 - channel[c].bits)) << channel[c].shift;
+		}
+		out[i] = pixel;
+	}
+	__atomic_store_n(&front, front ^ 1, __ATOMIC_RELEASE);
+}
+
+const uint32_t* palette_lut(void)
+{
+	return lut[__atomic_load_n(&front, __ATOMIC_ACQUIRE)];
+}
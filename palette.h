@@ -0,0 +1,26 @@
+#ifndef _PALETTE_H_
+#define _PALETTE_H_
+
+#include <X11/Xlib.h>
+#include <stdint.h>
+
+/**
+ * Colour palettes. A palette is a cyclic gradient of a few colour stops,
+ * main rotates it once per frame and packs it into a table of pixel
+ * values for the image's visual. Effects fetch the table at the start
+ * of a step and colour by index, no colour math in their inner loops.
+ *
+ * The table is double buffered, a pointer from palette_lut() stays valid
+ * for at least one frame.
+ */
+
+#define PALETTE_SIZE 256
+#define PALETTE_MASK (PALETTE_SIZE - 1)
+
+int palette_select(const char* spec);  //"name" or "name,seconds per cycle", 0 on success
+void palette_list(void);
+void palette_setup(XImage* img);       //pixel layout, builds the first table
+void palette_update(double t);         //once per frame, t in seconds
+const uint32_t* palette_lut(void);
+
+#endif /* _PALETTE_H_ */
@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <pthread.h>
+#include "bg.h"
+#include "arena.h"
+#include "parallel.h"
+
+typedef struct
+{
+	parallel_fn fn;
+	void* arg;
+	int n;
+	int chunks;
+	int next;  //next chunk to take
+	int done;  //chunks finished
+	int refs;  //the caller and every submitted helper
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} parallel_job_t;
+
+static threadpool_t* parallel_pool = NULL;
+static int parallel_helpers = 0;
+static objpool_t jobs;
+static pthread_once_t jobs_once = PTHREAD_ONCE_INIT;
+
+static void JobsInit(void)
+{
+	objpool_init(&jobs, sizeof(parallel_job_t), 64, 8);
+}
+
+void parallel_setup(threadpool_t* pool, int helpers)
+{
+	parallel_pool = pool;
+	parallel_helpers = helpers < 0 ? 0 : helpers;
+}
+
+int parallel_chunks(int n, int grain)
+{
+	int chunks = grain > 0 ? (n + grain - 1) / grain : 1;
+	if(chunks > PARALLEL_MAX_CHUNKS)
+		chunks = PARALLEL_MAX_CHUNKS;
+	return chunks < 1 ? 1 : chunks;
+}
+
+static void JobRelease(parallel_job_t* job)
+{
+	if(__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		pthread_mutex_destroy(&job->lock);
+		pthread_cond_destroy(&job->cond);
+		objpool_put(&jobs, job);
+	}
+}
+
+static void JobRun(parallel_job_t* job)
+{
+	int c;
+	int per = (job->n + job->chunks - 1) / job->chunks;
+	while((c = __atomic_fetch_add(&job->next, 1, __ATOMIC_ACQ_REL)) < job->chunks)
+	{
+		int begin = c * per;
+		int end = begin + per < job->n ? begin + per : job->n;
+		job->fn(job->arg, c, begin, end);
+		if(__atomic_add_fetch(&job->done, 1, __ATOMIC_ACQ_REL) == job->chunks)
+		{
+			pthread_mutex_lock(&job->lock);
+			pthread_cond_signal(&job->cond);
+			pthread_mutex_unlock(&job->lock);
+		}
+	}
+}
+
+static void JobHelper(void* arg)
+{
+	JobRun(arg);
+	JobRelease(arg);
+}
+
+void parallel_for(int n, int grain, parallel_fn fn, void* arg)
+{
+	int chunks = parallel_chunks(n, grain);
+	if(chunks == 1 || !parallel_pool || !parallel_helpers)
+	{
+		int per = (n + chunks - 1) / chunks;
+		for(int c = 0; c < chunks; c++)
+			fn(arg, c, c * per, (c + 1) * per < n ? (c + 1) * per : n);
+		return;
+	}
+	pthread_once(&jobs_once, JobsInit);
+	parallel_job_t* job = objpool_get(&jobs);
+	job->fn = fn;
+	job->arg = arg;
+	job->n = n;
+	job->chunks = chunks;
+	job->refs = 1;
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->cond, NULL);
+
+	int helpers = parallel_helpers < chunks - 1 ? parallel_helpers : chunks - 1;
+	for(int i = 0; i < helpers; i++)
+	{
+		__atomic_add_fetch(&job->refs, 1, __ATOMIC_ACQ_REL);
+		if(threadpool_add(parallel_pool, JobHelper, job, 0))
+		{
+			__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL);
+			break; //queue full, the caller does the rest
+		}
+	}
+	JobRun(job);
+	pthread_mutex_lock(&job->lock);
+	while(__atomic_load_n(&job->done, __ATOMIC_ACQUIRE) < chunks)
+		pthread_cond_wait(&job->cond, &job->lock);
+	pthread_mutex_unlock(&job->lock);
+	JobRelease(job);
+}
@@ -0,0 +1,22 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include "threadpool.h"
+
+/**
+ * Data parallel loops on the pool. parallel_for() cuts [0, n) into
+ * chunks of grain items and hands them out through a shared counter;
+ * the calling thread works on them too, so the loop finishes even when
+ * every worker is busy with an effect. Helpers that start late find no
+ * work left and just return.
+ */
+
+#define PARALLEL_MAX_CHUNKS 64
+
+typedef void (*parallel_fn)(void* arg, int chunk, int begin, int end);
+
+void parallel_setup(threadpool_t* pool, int helpers);
+int parallel_chunks(int n, int grain); //the chunk count parallel_for() will use
+void parallel_for(int n, int grain, parallel_fn fn, void* arg);
+
+#endif /* _PARALLEL_H_ */
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "bg.h"
+#include "effect.h"
+#include "particle.h"
+
+static int default_count = PARTICLE_DEFAULT;
+static struct { char name[64]; int count; } counts[MAX_EFFECTS];
+static int num_counts = 0;
+static particle_pool_t pools[MAX_EFFECTS + 1]; //indexed by effect id
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int particle_config(const char* spec)
+{
+	const char* eq = strchr(spec, '=');
+	const char* num = eq ? eq + 1 : spec;
+	char* end;
+	long n = strtol(num, &end, 0);
+	if(end == num || *end || n < PARTICLE_MIN || n > PARTICLE_MAX)
+	{
+		printf("Invalid particle count %s, %d to %d\n", num, PARTICLE_MIN, PARTICLE_MAX);
+		return -1;
+	}
+	if(!eq)
+	{
+		default_count = n;
+		return 0;
+	}
+	size_t len = eq - spec;
+	if(len == 0 || len >= sizeof(counts[0].name) || num_counts == MAX_EFFECTS)
+		return -1;
+	memcpy(counts[num_counts].name, spec, len);
+	counts[num_counts].name[len] = 0;
+	counts[num_counts++].count = n;
+	return 0;
+}
+
+int particle_count(const char* name)
+{
+	for(int i = num_counts - 1; i >= 0; i--) //the last one given wins
+		if(!strcmp(counts[i].name, name))
+			return counts[i].count;
+	return default_count;
+}
+
+//aligned_alloc wants a multiple of the alignment
+static size_t Aligned(size_t bytes)
+{
+	return (bytes + PARTICLE_ALIGN - 1) & ~(size_t)(PARTICLE_ALIGN - 1);
+}
+
+size_t particle_pool_bytes(int count, int moving)
+{
+	size_t words = Aligned((size_t)count * sizeof(uint32_t));
+	return Aligned((size_t)count * sizeof(struct particle)) + words + 2 * words + (moving ? 2 * words : 0);
+}
+
+static int PoolAlloc(particle_pool_t* pool, int count)
+{
+	size_t size = Aligned((size_t)count * sizeof(struct particle));
+	size_t words = Aligned((size_t)count * sizeof(uint32_t));
+	pool->buf = aligned_alloc(PARTICLE_ALIGN, size);
+	pool->scratch = aligned_alloc(PARTICLE_ALIGN, words);
+	pool->last = aligned_alloc(PARTICLE_ALIGN, 2 * words);
+	if(!pool->buf || !pool->scratch || !pool->last)
+	{
+		free(pool->buf);
+		free(pool->scratch);
+		free(pool->last);
+		return -1;
+	}
+	memset(pool->buf, 0, size);
+	memset(pool->last, 0, 2 * words);
+	pool->vel = NULL;
+	pool->count = count;
+	pool->ready = 0;
+	return 0;
+}
+
+particle_pool_t* particle_acquire(int id, const char* name)
+{
+	int count = particle_count(name);
+	particle_pool_t* pool = NULL;
+	pthread_mutex_lock(&pool_lock);
+	if(id > 0 && id <= MAX_EFFECTS && !pools[id].busy)
+	{
+		pool = &pools[id];
+		if(!pool->buf)
+			ASSERT(PoolAlloc(pool, count) == 0, "Out of memory!");
+		pool->busy = 1;
+		pool->shared = 1;
+	}
+	pthread_mutex_unlock(&pool_lock);
+	if(pool)
+		return pool;
+
+	//overlapping instance of the same effect
+	pool = calloc(1, sizeof(*pool));
+	ASSERT(pool && PoolAlloc(pool, count) == 0, "Out of memory!");
+	pool->busy = 1;
+	return pool;
+}
+
+particle_pool_t* particle_adopt(int id, struct particle* buf, float* vel, int count, int ready)
+{
+	particle_pool_t* pool = &pools[id];
+	size_t words = Aligned((size_t)count * sizeof(uint32_t));
+	pthread_mutex_lock(&pool_lock);
+	ASSERT(!pool->buf, "Particle pool already in use!");
+	pool->scratch = aligned_alloc(PARTICLE_ALIGN, words);
+	pool->last = aligned_alloc(PARTICLE_ALIGN, 2 * words);
+	ASSERT(pool->scratch && pool->last, "Out of memory!");
+	pool->buf = buf;
+	pool->vel = vel;
+	pool->count = count;
+	pool->ready = ready;
+	particle_remember(pool, count);
+	pthread_mutex_unlock(&pool_lock);
+	return pool;
+}
+
+void particle_release(particle_pool_t* pool)
+{
+	if(!pool)
+		return;
+	if(!pool->shared)
+	{
+		free(pool->buf);
+		free(pool->scratch);
+		free(pool->last);
+		free(pool->vel);
+		free(pool);
+		return;
+	}
+	pthread_mutex_lock(&pool_lock);
+	pool->busy = 0;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void particle_remember(particle_pool_t* pool, int n)
+{
+	for(int i = 0; i < n; i++)
+	{
+		pool->last[2 * i] = pool->buf[i].x;
+		pool->last[2 * i + 1] = pool->buf[i].y;
+	}
+}
+
+float* particle_velocities(particle_pool_t* pool)
+{
+	if(!pool->vel)
+	{
+		size_t words = Aligned((size_t)pool->count * sizeof(uint32_t));
+		pool->vel = aligned_alloc(PARTICLE_ALIGN, 2 * words);
+		ASSERT(pool->vel, "Out of memory!");
+		memset(pool->vel, 0, 2 * words);
+	}
+	return pool->vel;
+}
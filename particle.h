@@ -0,0 +1,70 @@
+#ifndef _PARTICLE_H_
+#define _PARTICLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Particle pools. Every effect id owns one cache line aligned pool that
+ * is allocated on its first start and kept for the life of the process,
+ * so a restarted effect picks up the particles of its previous run
+ * instead of allocating and scattering a fresh set. A second instance
+ * running at the same time gets a private pool, freed on release.
+ *
+ * The size is PARTICLE_DEFAULT unless configured with particle_config(),
+ * either for every effect ("20000") or for one by name ("Galaxy=100000").
+ *
+ * Effects move particles in their fixed timestep tick and draw them in
+ * step, which usually falls between two ticks: particle_remember() keeps
+ * the positions before a tick and particle_at() blends the two.
+ * Effects that integrate velocities keep them in the pool as well,
+ * particle_velocities(), so restarts and snapshots carry them along.
+ */
+
+#define PARTICLE_DEFAULT 4096
+#define PARTICLE_MIN 64
+#define PARTICLE_MAX (1 << 24)
+#define PARTICLE_ALIGN 64
+
+//ready flags
+#define PARTICLE_READY 1  //buf is initialised
+#define PARTICLE_MOVING 2 //vel holds the velocities of buf
+
+struct particle
+{
+	double x;
+	double y;
+	double speed;
+	double direction;
+};
+
+typedef struct particle_pool
+{
+	struct particle* buf;
+	uint32_t* scratch; //one word per particle for per-step temporaries
+	float* last;       //x, y pairs as of the previous tick
+	float* vel;        //x, y pairs, NULL until particle_velocities()
+	int count;
+	int ready;         //PARTICLE_READY | PARTICLE_MOVING, set by the owner, survives restarts
+	int busy;
+	int shared;        //the per-id pool, not a private one
+} particle_pool_t;
+
+int particle_config(const char* spec); //0 on success
+int particle_count(const char* name);
+size_t particle_pool_bytes(int count, int moving); //buf, scratch, last and with moving vel, as allocated
+particle_pool_t* particle_acquire(int id, const char* name);
+particle_pool_t* particle_adopt(int id, struct particle* buf, float* vel, int count, int ready); //per-id pool in caller's memory
+void particle_release(particle_pool_t* pool);
+void particle_remember(particle_pool_t* pool, int n); //before a tick moves the first n, or after a jump
+float* particle_velocities(particle_pool_t* pool);    //zeroed on first use, without PARTICLE_MOVING
+
+//alpha of the way from the previous tick to the last one
+static inline void particle_at(const particle_pool_t* pool, int i, double alpha, double* x, double* y)
+{
+	const float* last = pool->last + 2 * i;
+	*x = last[0] + (pool->buf[i].x - last[0]) * alpha;
+	*y = last[1] + (pool->buf[i].y - last[1]) * alpha;
+}
+
+#endif /* _PARTICLE_H_ */
@@ -0,0 +1,318 @@
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "bg.h"
+#include "present.h"
+#include "trace.h"
+#include "draw.h"
+#include "submit.h"
+
+static Display* pdpy;
+static int pscreen;
+static Window proot;
+static Pixmap pix;
+static int pmode = PRESENT_CLEAR;
+static int tiles_x, tiles_y;
+static uint8_t* dirty;     //one flag per tile
+static char* shadow;       //the last uploaded frame, raster backend
+static int full = 1;       //the pixmap content is undefined before the first frame
+static Display* udpy;      //upload connection of the raster backend
+static int xcb = 0;        //submitting through submit.c instead, from the same thread
+static XImage* upload_img;
+static uint64_t kicked = 0;
+static int uploading = 0;
+static pthread_t upload_thread;
+static pthread_mutex_t upload_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t upload_kicked = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t upload_done = PTHREAD_COND_INITIALIZER;
+
+static void* UploadThread(void* arg);
+
+static int IgnoreErrors(Display* dpy, XErrorEvent* err)
+{
+	(void)dpy;
+	(void)err;
+	return 0;
+}
+
+static Pixmap RootProperty(Atom atom)
+{
+	Atom type;
+	int format;
+	unsigned long n, after;
+	unsigned char* data = NULL;
+	Pixmap p = None;
+	if(XGetWindowProperty(pdpy, proot, atom, 0, 1, False, XA_PIXMAP, &type, &format, &n, &after, &data) == Success
+		&& type == XA_PIXMAP && format == 32 && n == 1)
+		p = *(Pixmap*)data;
+	if(data)
+		XFree(data);
+	return p;
+}
+
+//created by a connection of its own that closes with RetainPermanent,
+//like Esetroot does, so only the pixmap outlives us and not every other
+//resource of the main connection
+static Pixmap RetainedPixmap(void)
+{
+	Display* rdpy = XOpenDisplay(DisplayString(pdpy));
+	ASSERT(rdpy, "Unable to open display!");
+	XSetCloseDownMode(rdpy, RetainPermanent);
+	Pixmap p = XCreatePixmap(rdpy, RootWindow(rdpy, pscreen), w, h, DefaultDepth(rdpy, pscreen));
+	XCloseDisplay(rdpy); //flushes the request, the pixmap stays
+	return p;
+}
+
+//the Esetroot convention: the previous setter left its pixmap retained
+//and published in both properties, killing it frees the pixmap
+static void Publish(void)
+{
+	Atom xroot = XInternAtom(pdpy, "_XROOTPMAP_ID", False);
+	Atom eroot = XInternAtom(pdpy, "ESETROOT_PMAP_ID", False);
+	Pixmap old = RootProperty(eroot);
+	if(old && old == RootProperty(xroot))
+	{
+		XSync(pdpy, False);
+		XErrorHandler handler = XSetErrorHandler(IgnoreErrors);
+		XKillClient(pdpy, old);
+		XSync(pdpy, False);
+		XSetErrorHandler(handler);
+	}
+	XChangeProperty(pdpy, proot, xroot, XA_PIXMAP, 32, PropModeReplace, (unsigned char*)&pix, 1);
+	XChangeProperty(pdpy, proot, eroot, XA_PIXMAP, 32, PropModeReplace, (unsigned char*)&pix, 1);
+	XSetWindowBackgroundPixmap(pdpy, proot, pix);
+}
+
+Pixmap present_open(Display* dpy, int screen, int mode, XImage* img)
+{
+	pdpy = dpy;
+	pscreen = screen;
+	pmode = mode;
+	proot = RootWindow(dpy, screen);
+	pix = mode == PRESENT_ROOT ? RetainedPixmap() : XCreatePixmap(dpy, proot, w, h, DefaultDepth(dpy, screen));
+	if(mode == PRESENT_ROOT)
+	{
+		tiles_x = (w + PRESENT_TILE - 1) / PRESENT_TILE;
+		tiles_y = (h + PRESENT_TILE - 1) / PRESENT_TILE;
+		dirty = calloc((size_t)tiles_x * tiles_y, 1);
+		ASSERT(dirty, "Out of memory!");
+		Publish();
+	}
+	if(img)
+	{
+		XSync(dpy, False);
+		xcb = submit_open(dpy, screen, pix, img) == 0;
+	}
+	if(!draw_server())
+	{
+		//Xlib is not used from two threads, the uploader gets its own
+		//connection; XCB's is thread-safe, main only polls submit.c's
+		if(!xcb)
+		{
+			XSync(dpy, False);
+			udpy = XOpenDisplay(DisplayString(dpy));
+			ASSERT(udpy, "Unable to open display!");
+		}
+		ASSERT(pthread_create(&upload_thread, NULL, UploadThread, NULL) == 0, "Unable to start upload thread!");
+	}
+	return pix;
+}
+
+void present_damage(int x, int y, int width, int height)
+{
+	if(pmode != PRESENT_ROOT)
+		return;
+	int x0 = x < 0 ? 0 : x / PRESENT_TILE;
+	int y0 = y < 0 ? 0 : y / PRESENT_TILE;
+	int x1 = x + width >= w ? tiles_x - 1 : (x + width) / PRESENT_TILE;
+	int y1 = y + height >= h ? tiles_y - 1 : (y + height) / PRESENT_TILE;
+	for(int ty = y0; ty <= y1; ty++)
+		for(int tx = x0; tx <= x1; tx++)
+			dirty[ty * tiles_x + tx] = 1;
+}
+
+//marks the tiles that differ from the shadow and brings the shadow up to date
+static void Diff(XImage* img)
+{
+	size_t bpp = img->bits_per_pixel / 8;
+	size_t len = (size_t)w * bpp;
+	size_t tile = PRESENT_TILE * bpp;
+	for(int y = 0; y < h; y++)
+	{
+		const char* a = img->data + (size_t)y * img->bytes_per_line;
+		char* b = shadow + (size_t)y * img->bytes_per_line;
+		if(!memcmp(a, b, len))
+			continue; //most rows of a frame did not change
+		uint8_t* row = dirty + (y / PRESENT_TILE) * tiles_x;
+		for(int tx = 0; tx < tiles_x; tx++)
+		{
+			size_t off = tx * tile;
+			size_t n = len - off < tile ? len - off : tile;
+			if(memcmp(a + off, b + off, n))
+			{
+				row[tx] = 1;
+				memcpy(b + off, a + off, n);
+			}
+		}
+	}
+}
+
+uint64_t present_band_bytes(Display* dpy)
+{
+	//BIG-REQUESTS lifts the limit to 4 GiB, Xlib enables it on connect
+	uint64_t max = XExtendedMaxRequestSize(dpy);
+	if(!max)
+		max = XMaxRequestSize(dpy);
+	max = max * 4 - 64; //in 4 byte units, less the PutImage header
+	return max < PRESENT_BAND_BYTES ? max : PRESENT_BAND_BYTES;
+}
+
+void present_put(Display* dpy, Drawable d, GC gc, XImage* img, int x, int y, int width, int height, uint64_t band_bytes)
+{
+	uint64_t row = (uint64_t)width * (img->bits_per_pixel / 8);
+	int rows = row ? (int)(band_bytes / row) : height;
+	if(rows < 1)
+		rows = 1; //XPutImage splits a single row itself
+	for(int b = y; b < y + height; b += rows)
+	{
+		XPutImage(dpy, d, gc, img, x, b, x, b, width, b + rows <= y + height ? rows : y + height - b);
+		XFlush(dpy); //the server starts on this band while the next is sent
+	}
+}
+
+//uploads the dirty tiles or the whole frame and exposes them, on any connection
+//NULL dpy submits through XCB
+static void Show(Display* dpy, XImage* img, uint64_t band_bytes)
+{
+	GC gc = dpy ? DefaultGC(dpy, pscreen) : NULL;
+	TRACE_BEGIN("upload");
+	if(pmode == PRESENT_CLEAR)
+	{
+		if(!dpy)
+		{
+			submit_put(img, 0, 0, w, h);
+			submit_background();
+			submit_clear(0, 0, 0, 0);
+			submit_end();
+		} else {
+			if(img)
+				present_put(dpy, pix, gc, img, 0, 0, w, h, band_bytes);
+			XSetWindowBackgroundPixmap(dpy, proot, pix);
+			XClearWindow(dpy, proot);
+			XFlush(dpy);
+		}
+		TRACE_END("upload");
+		return;
+	}
+	//one upload and one expose per run of dirty tiles in a tile row
+	for(int ty = 0; ty < tiles_y; ty++)
+	{
+		uint8_t* row = dirty + ty * tiles_x;
+		int y = ty * PRESENT_TILE;
+		int height = y + PRESENT_TILE <= h ? PRESENT_TILE : h - y;
+		for(int tx = 0; tx < tiles_x; tx++)
+		{
+			if(!row[tx])
+				continue;
+			int run = tx;
+			while(run < tiles_x && row[run])
+				row[run++] = 0;
+			int x = tx * PRESENT_TILE;
+			int width = run * PRESENT_TILE <= w ? (run - tx) * PRESENT_TILE : w - x;
+			if(!dpy)
+			{
+				submit_put(img, x, y, width, height);
+				submit_clear(x, y, width, height);
+			} else {
+				if(img)
+					present_put(dpy, pix, gc, img, x, y, width, height, band_bytes);
+				XClearArea(dpy, proot, x, y, width, height, False);
+			}
+			tx = run;
+		}
+	}
+	if(!dpy)
+		submit_end();
+	else
+		XFlush(dpy);
+	TRACE_END("upload");
+}
+
+static void* UploadThread(void* arg)
+{
+	(void)arg;
+	uint64_t band_bytes = udpy ? present_band_bytes(udpy) : submit_band_bytes();
+	uint64_t seen = 0;
+	while(1)
+	{
+		pthread_mutex_lock(&upload_lock);
+		while(kicked == seen)
+			pthread_cond_wait(&upload_kicked, &upload_lock);
+		seen = kicked;
+		XImage* img = upload_img;
+		pthread_mutex_unlock(&upload_lock);
+
+		Show(udpy, img, band_bytes);
+
+		pthread_mutex_lock(&upload_lock);
+		uploading = 0;
+		pthread_cond_signal(&upload_done);
+		pthread_mutex_unlock(&upload_lock);
+	}
+	return NULL;
+}
+
+//one frame in flight: the dirty flags and the shadow are the uploader's until then
+static void WaitUpload(void)
+{
+	pthread_mutex_lock(&upload_lock);
+	while(uploading)
+		pthread_cond_wait(&upload_done, &upload_lock);
+	pthread_mutex_unlock(&upload_lock);
+}
+
+void present_wait(void)
+{
+	if(udpy || xcb)
+		WaitUpload();
+}
+
+void present_frame(XImage* img)
+{
+	if(img && (udpy || xcb))
+		WaitUpload();
+	if(xcb && submit_busy())
+		return; //the next frame's diff still sees everything that changed
+	if(pmode == PRESENT_ROOT)
+	{
+		if(full)
+		{
+			memset(dirty, 1, (size_t)tiles_x * tiles_y);
+			if(img)
+			{
+				shadow = malloc((size_t)img->bytes_per_line * h);
+				ASSERT(shadow, "Out of memory!");
+				memcpy(shadow, img->data, (size_t)img->bytes_per_line * h);
+			}
+			full = 0;
+		} else if(img) {
+			TRACE_BEGIN("diff");
+			Diff(img);
+			TRACE_END("diff");
+		}
+	}
+	if(!img || (!udpy && !xcb))
+	{
+		//the server backend drew on this connection, exposing on another could overtake it
+		Show(pdpy, img, present_band_bytes(pdpy));
+		return;
+	}
+	pthread_mutex_lock(&upload_lock);
+	upload_img = img;
+	uploading = 1;
+	kicked++;
+	pthread_cond_signal(&upload_kicked);
+	pthread_mutex_unlock(&upload_lock);
+}
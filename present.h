@@ -0,0 +1,41 @@
+#ifndef _PRESENT_H_
+#define _PRESENT_H_
+
+#include <X11/Xlib.h>
+#include <stdint.h>
+
+/**
+ * Getting frames onto the root window. PRESENT_CLEAR uploads into a
+ * pixmap, sets it as the root background and clears the whole root
+ * every frame. PRESENT_ROOT installs one persistent pixmap as the
+ * background, published in _XROOTPMAP_ID and ESETROOT_PMAP_ID so that
+ * compositors and pseudo-transparent clients follow it. Like a
+ * wallpaper setter's it is created by a short-lived connection closed
+ * with RetainPermanent, so it alone stays after exit. Every frame only
+ * the tiles that changed are uploaded and exposed with XClearArea: the
+ * raster backend finds them by comparing the image with the last
+ * frame, the server backend reports what it drew through
+ * present_damage().
+ *
+ * The raster backend uploads on a thread with its own connection, so
+ * main and the effects go on with the next frame meanwhile. Uploads are
+ * cut into bands below the maximum request size (BIG-REQUESTS when the
+ * server has it) and PRESENT_BAND_BYTES, flushed one by one so the
+ * server works on a band while the next one is sent. With the xcb
+ * backend the same thread submits the frames through submit.c instead.
+ */
+
+#define PRESENT_CLEAR 0
+#define PRESENT_ROOT 1
+#define PRESENT_TILE 64
+#define PRESENT_BAND_BYTES (1 << 20)
+
+Pixmap present_open(Display* dpy, int screen, int mode, XImage* img); //img for the xcb backend, else NULL
+void present_damage(int x, int y, int width, int height);
+void present_wait(void);          //the last frame is uploaded, the image may change
+void present_frame(XImage* img); //NULL when the pixmap was drawn already
+
+uint64_t present_band_bytes(Display* dpy);
+void present_put(Display* dpy, Drawable d, GC gc, XImage* img, int x, int y, int width, int height, uint64_t band_bytes);
+
+#endif /* _PRESENT_H_ */
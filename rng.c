@@ -0,0 +1,82 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "rng.h"
+
+static uint64_t global_seed = 0x9E3779B97F4A7C15ull;
+static uint64_t thread_streams;
+static __thread rng_t thread_rng;
+static __thread int thread_rng_ready;
+
+static uint64_t splitmix64(uint64_t* x)
+{
+	uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+void rng_seed(uint64_t seed)
+{
+	global_seed = seed;
+}
+
+uint64_t rng_get_seed(void)
+{
+	return global_seed;
+}
+
+void rng_init(rng_t* r, uint64_t stream)
+{
+	uint64_t x = global_seed ^ (stream * 0xD1B54A32D192ED03ull);
+	for(int i = 0; i < 4; i++)
+		r->s[i] = splitmix64(&x);
+	for(int i = 0; i < 4; i++)
+		for(int l = 0; l < 8; l++)
+			r->v[i][l] = (uint32_t)splitmix64(&x) | 1;
+}
+
+rng_t* rng_thread(void)
+{
+	if(!thread_rng_ready)
+	{
+		//thread streams live in the upper half of the id space
+		uint64_t id = __atomic_fetch_add(&thread_streams, 1, __ATOMIC_RELAXED);
+		rng_init(&thread_rng, (1ull << 63) | id);
+		thread_rng_ready = 1;
+	}
+	return &thread_rng;
+}
+
+#define ROTL_LANES(x, k) (((x) << (k)) | ((x) >> (32 - (k))))
+
+void rng_fill(rng_t* r, uint32_t* out, size_t n, uint32_t range)
+{
+	rng_lanes_t s0 = r->v[0], s1 = r->v[1], s2 = r->v[2], s3 = r->v[3];
+	size_t i = 0;
+	while(i < n)
+	{
+		rng_lanes_t res = ROTL_LANES(s1 * 5, 7) * 9;
+		rng_lanes_t t = s1 << 9;
+		s2 ^= s0;
+		s3 ^= s1;
+		s1 ^= s2;
+		s0 ^= s3;
+		s2 ^= t;
+		s3 = ROTL_LANES(s3, 11);
+		if(n - i >= 8)
+		{
+			__builtin_memcpy(out + i, &res, sizeof(res));
+			i += 8;
+		} else {
+			for(int l = 0; i < n; l++)
+				out[i++] = res[l];
+		}
+	}
+	r->v[0] = s0;
+	r->v[1] = s1;
+	r->v[2] = s2;
+	r->v[3] = s3;
+	if(range)
+		for(i = 0; i < n; i++)
+			out[i] = (uint32_t)(((uint64_t)out[i] * range) >> 32);
+}
@@ -0,0 +1,61 @@
+#ifndef _RNG_H_
+#define _RNG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Seedable random streams replacing rand(), which serialises all effect
+ * threads on a global lock in glibc. Every stream is derived from the
+ * global seed and a stream id, so a run can be reproduced with the same
+ * seed. Scalar draws use xoshiro256**, rng_fill() runs 8 xoshiro128**
+ * lanes side by side so the compiler can keep them in vector registers.
+ */
+
+typedef uint32_t rng_lanes_t __attribute__((vector_size(32)));
+
+typedef struct {
+	uint64_t s[4];
+	rng_lanes_t v[4];
+} rng_t;
+
+void rng_seed(uint64_t seed);
+uint64_t rng_get_seed(void);
+
+void rng_init(rng_t* r, uint64_t stream);
+rng_t* rng_thread(void); //lazily seeded stream private to the calling thread
+
+void rng_fill(rng_t* r, uint32_t* out, size_t n, uint32_t range); //range 0 = full 32 bits
+
+static inline uint64_t rng_rotl(const uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(rng_t* r)
+{
+	uint64_t* s = r->s;
+	const uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rng_rotl(s[3], 45);
+	return result;
+}
+
+//uniform in [0, range)
+static inline uint32_t rng_range(rng_t* r, uint32_t range)
+{
+	return (uint32_t)(((rng_next(r) >> 32) * range) >> 32);
+}
+
+//uniform in [0, 1)
+static inline double rng_double(rng_t* r)
+{
+	return (rng_next(r) >> 11) * 0x1.0p-53;
+}
+
+#endif /* _RNG_H_ */
@@ -0,0 +1,173 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "bg.h"
+#include "screens.h"
+#include "trace.h"
+#include "memory.h"
+#include "present.h"
+
+typedef struct
+{
+	Display* dpy;   //own connection, Xlib is not used from two threads
+	int screen;
+	Window root;
+	Pixmap pix;
+	XImage* img;    //the canvas itself when the formats match
+	int* xmap;      //canvas column of every screen column, NULL when shared
+	uint64_t band;  //upload band size for this connection
+	pthread_t thread;
+} extra_t;
+
+static extra_t extras[MAX_SCREENS];
+static int num_extras = 0;
+static XImage* canvas;
+static uint64_t frame = 0; //kicked frames, guarded by screens_lock
+static int pending = 0;
+static pthread_mutex_t screens_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t screens_kicked = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t screens_done = PTHREAD_COND_INITIALIZER;
+
+static int Shift(unsigned long mask)
+{
+	return mask ? __builtin_ctzl(mask) : 0;
+}
+
+//a channel of sbits scaled to dbits; widening repeats the high bits so
+//that full intensity stays full on 10 bit visuals
+static unsigned long Scale(unsigned long v, int sbits, int dbits)
+{
+	if(dbits <= sbits)
+		return v >> (sbits - dbits);
+	unsigned long out = 0;
+	for(int have = 0; have < dbits; have += sbits)
+		out |= have + sbits <= dbits ? v << (dbits - have - sbits) : v >> (have + sbits - dbits);
+	return out;
+}
+
+//nearest neighbour scale, channels moved from the canvas masks to the screen's
+static void Repack(extra_t* s)
+{
+	XImage* d = s->img;
+	int rs = Shift(canvas->red_mask), gs = Shift(canvas->green_mask), bs = Shift(canvas->blue_mask);
+	int rd = Shift(d->red_mask), gd = Shift(d->green_mask), bd = Shift(d->blue_mask);
+	int rsb = __builtin_popcountl(canvas->red_mask), rdb = __builtin_popcountl(d->red_mask);
+	int gsb = __builtin_popcountl(canvas->green_mask), gdb = __builtin_popcountl(d->green_mask);
+	int bsb = __builtin_popcountl(canvas->blue_mask), bdb = __builtin_popcountl(d->blue_mask);
+	for(int y = 0; y < d->height; y++)
+	{
+		const uint32_t* src = (const uint32_t*)(canvas->data + (size_t)(y * (int64_t)canvas->height / d->height) * canvas->bytes_per_line);
+		for(int x = 0; x < d->width; x++)
+		{
+			uint32_t p = src[s->xmap[x]];
+			unsigned long r = Scale((p & canvas->red_mask) >> rs, rsb, rdb);
+			unsigned long g = Scale((p & canvas->green_mask) >> gs, gsb, gdb);
+			unsigned long b = Scale((p & canvas->blue_mask) >> bs, bsb, bdb);
+			unsigned long pixel = (r << rd & d->red_mask) | (g << gd & d->green_mask) | (b << bd & d->blue_mask);
+			if(d->bits_per_pixel == 32)
+				((uint32_t*)(d->data + (size_t)y * d->bytes_per_line))[x] = pixel;
+			else
+				XPutPixel(d, x, y, pixel);
+		}
+	}
+}
+
+static void* ScreenThread(void* arg)
+{
+	extra_t* s = arg;
+	uint64_t seen = 0;
+	GC gc = DefaultGC(s->dpy, s->screen);
+	while(1)
+	{
+		pthread_mutex_lock(&screens_lock);
+		while(frame == seen)
+			pthread_cond_wait(&screens_kicked, &screens_lock);
+		seen = frame;
+		pthread_mutex_unlock(&screens_lock);
+
+		TRACE_BEGIN("upload screen");
+		if(s->xmap)
+			Repack(s);
+		present_put(s->dpy, s->pix, gc, s->img, 0, 0, s->img->width, s->img->height, s->band);
+		XSetWindowBackgroundPixmap(s->dpy, s->root, s->pix);
+		XClearWindow(s->dpy, s->root);
+		XFlush(s->dpy);
+		TRACE_END("upload screen");
+
+		pthread_mutex_lock(&screens_lock);
+		if(--pending == 0)
+			pthread_cond_signal(&screens_done);
+		pthread_mutex_unlock(&screens_lock);
+	}
+	return NULL;
+}
+
+static int SameFormat(XImage* a, Visual* v, int depth, int width, int height)
+{
+	return a->width == width && a->height == height && a->depth == depth
+		&& a->red_mask == v->red_mask && a->green_mask == v->green_mask && a->blue_mask == v->blue_mask;
+}
+
+int screens_open(Display* dpy, XImage* img)
+{
+	canvas = img;
+	for(int i = 0; i < ScreenCount(dpy) && num_extras < MAX_SCREENS; i++)
+	{
+		if(i == DefaultScreen(dpy))
+			continue;
+		Visual* visual = DefaultVisual(dpy, i);
+		int depth = DefaultDepth(dpy, i);
+		if(visual->class != TrueColor || canvas->bits_per_pixel != 32)
+		{
+			printf("Screen %d skipped, no TrueColor visual\n", i);
+			continue;
+		}
+		extra_t* s = &extras[num_extras];
+		s->dpy = XOpenDisplay(DisplayString(dpy));
+		ASSERT(s->dpy, "Unable to open display!");
+		s->screen = i;
+		s->root = RootWindow(s->dpy, i);
+		s->band = present_band_bytes(s->dpy);
+		int width = DisplayWidth(s->dpy, i);
+		int height = DisplayHeight(s->dpy, i);
+		if(SameFormat(canvas, visual, depth, width, height))
+			s->img = canvas;
+		else {
+			s->img = XCreateImage(s->dpy, DefaultVisual(s->dpy, i), depth, ZPixmap, 0, NULL, width, height, 32, 0);
+			ASSERT(s->img, "Unable to create image!");
+			s->img->data = memory_frame((size_t)s->img->bytes_per_line * height);
+			s->xmap = malloc(sizeof(int) * width);
+			ASSERT(s->img->data && s->xmap, "Out of memory!");
+			for(int x = 0; x < width; x++)
+				s->xmap[x] = x * (int64_t)canvas->width / width;
+		}
+		s->pix = XCreatePixmap(s->dpy, s->root, width, height, depth);
+		ASSERT(pthread_create(&s->thread, NULL, ScreenThread, s) == 0, "Unable to start screen thread!");
+		printf("Screen %d %dx%d%s\n", i, width, height, s->xmap ? ", scaled copy" : "");
+		num_extras++;
+	}
+	return num_extras;
+}
+
+void screens_kick(void)
+{
+	if(!num_extras)
+		return;
+	pthread_mutex_lock(&screens_lock);
+	frame++;
+	pending = num_extras;
+	pthread_cond_broadcast(&screens_kicked);
+	pthread_mutex_unlock(&screens_lock);
+}
+
+void screens_wait(void)
+{
+	pthread_mutex_lock(&screens_lock);
+	while(pending)
+		pthread_cond_wait(&screens_done, &screens_lock);
+	pthread_mutex_unlock(&screens_lock);
+}
@@ -0,0 +1,20 @@
+#ifndef _SCREENS_H_
+#define _SCREENS_H_
+
+#include <X11/Xlib.h>
+
+/**
+ * The other screens of a multi-screen (Zaphod) display. The simulation
+ * draws once into the canvas of the default screen, every other screen
+ * gets its own connection and upload thread. A screen with the canvas'
+ * size and pixel format uploads the canvas as is, any other one gets a
+ * scaled and repacked copy in a buffer of its own.
+ */
+
+#define MAX_SCREENS 16
+
+int screens_open(Display* dpy, XImage* canvas); //number of extra screens
+void screens_kick(void);  //start uploading the canvas to every extra screen
+void screens_wait(void);  //until all of them are done
+
+#endif /* _SCREENS_H_ */
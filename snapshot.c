@@ -0,0 +1,166 @@
+#include <X11/Xlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "bg.h"
+#include "effect.h"
+#include "particle.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "bgsnap\0"
+#define SNAPSHOT_VERSION 2
+#define PAGE 4096
+
+typedef struct
+{
+	char name[32];
+	int32_t count;
+	uint32_t ready;   //the pool's ready flags when last synced
+	uint64_t offset;
+	uint64_t vel;     //offset of the velocities, x, y float pairs
+} snapshot_entry_t;
+
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	int32_t width;
+	int32_t height;
+	int32_t bytes_per_line;
+	int32_t bits_per_pixel;
+	int32_t entries;
+	uint64_t size;
+	uint64_t frame;   //offset of the image data
+	snapshot_entry_t entry[MAX_EFFECTS];
+} snapshot_header_t;
+
+static snapshot_header_t* map = NULL;
+static particle_pool_t* pools[MAX_EFFECTS];
+static double interval = SNAPSHOT_INTERVAL;
+static double last = 0;
+
+static uint64_t PageAlign(uint64_t n)
+{
+	return (n + PAGE - 1) & ~(uint64_t)(PAGE - 1);
+}
+
+//the header this run needs, compared with the file before resuming
+static void Layout(snapshot_header_t* hdr, XImage* img)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic));
+	hdr->version = SNAPSHOT_VERSION;
+	hdr->width = img->width;
+	hdr->height = img->height;
+	hdr->bytes_per_line = img->bytes_per_line;
+	hdr->bits_per_pixel = img->bits_per_pixel;
+	hdr->frame = PageAlign(sizeof(*hdr));
+	uint64_t at = hdr->frame + PageAlign((uint64_t)img->bytes_per_line * img->height);
+	for(int id = 1; id <= effect_count(); id++)
+	{
+		const effect_t* e = effect_get(id);
+		if(!(e->hints & EFFECT_HINT_PARTICLES) || !effect_enabled(id))
+			continue;
+		snapshot_entry_t* en = &hdr->entry[hdr->entries++];
+		snprintf(en->name, sizeof(en->name), "%s", e->name);
+		en->count = particle_count(e->name);
+		en->offset = at;
+		at += PageAlign((uint64_t)en->count * sizeof(struct particle));
+		en->vel = at;
+		at += PageAlign((uint64_t)en->count * 2 * sizeof(float));
+	}
+	hdr->size = at;
+}
+
+static int Matches(const snapshot_header_t* file, const snapshot_header_t* want)
+{
+	if(memcmp(file->magic, want->magic, sizeof(want->magic)) || file->version != want->version)
+		return 0;
+	if(file->width != want->width || file->height != want->height || file->size != want->size
+		|| file->bytes_per_line != want->bytes_per_line || file->bits_per_pixel != want->bits_per_pixel
+		|| file->frame != want->frame || file->entries != want->entries)
+		return 0;
+	for(int i = 0; i < want->entries; i++)
+		if(strcmp(file->entry[i].name, want->entry[i].name) || file->entry[i].count != want->entry[i].count
+			|| file->entry[i].offset != want->entry[i].offset || file->entry[i].vel != want->entry[i].vel)
+			return 0;
+	return 1;
+}
+
+int snapshot_open(const char* spec, XImage* img)
+{
+	char path[4096];
+	const char* comma = strrchr(spec, ',');
+	size_t len = comma ? (size_t)(comma - spec) : strlen(spec);
+	if(len == 0 || len >= sizeof(path))
+		return -1;
+	memcpy(path, spec, len);
+	path[len] = 0;
+	if(comma)
+		interval = atof(comma + 1);
+
+	snapshot_header_t want;
+	Layout(&want, img);
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	if(flock(fd, LOCK_EX | LOCK_NB))
+	{
+		printf("Snapshot %s is used by another instance\n", path);
+		close(fd);
+		return -1;
+	}
+	struct stat st;
+	snapshot_header_t have;
+	int resume = fstat(fd, &st) == 0 && (uint64_t)st.st_size == want.size
+		&& pread(fd, &have, sizeof(have), 0) == sizeof(have) && Matches(&have, &want);
+	if(!resume)
+	{
+		//zero filled: a black frame and particles that still need scattering
+		if(ftruncate(fd, 0) || ftruncate(fd, want.size) || pwrite(fd, &want, sizeof(want), 0) != sizeof(want))
+		{
+			perror(path);
+			close(fd);
+			return -1;
+		}
+	}
+	map = mmap(NULL, want.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); //the mapping keeps the file and its lock
+	if(map == MAP_FAILED)
+	{
+		map = NULL;
+		perror(path);
+		return -1;
+	}
+
+	img->data = (char*)map + map->frame;
+	for(int i = 0; i < map->entries; i++)
+	{
+		snapshot_entry_t* en = &map->entry[i];
+		struct particle* buf = (struct particle*)((char*)map + en->offset);
+		float* vel = (float*)((char*)map + en->vel);
+		pools[i] = particle_adopt(effect_find(en->name), buf, vel, en->count, resume ? en->ready : 0);
+	}
+	printf("Snapshot %s %s\n", path, resume ? "resumed" : "created");
+	return resume;
+}
+
+void snapshot_sync(double now)
+{
+	if(!map || now - last < interval)
+		return;
+	last = now;
+	for(int i = 0; i < map->entries; i++)
+		map->entry[i].ready = __atomic_load_n(&pools[i]->ready, __ATOMIC_ACQUIRE);
+	//the pages are shared with the page cache already, this only schedules writeback
+	msync(map, map->size, MS_ASYNC);
+}
@@ -0,0 +1,25 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <X11/Xlib.h>
+
+/**
+ * Memory-mapped snapshot of the last frame and the particle pools. The
+ * image and the pools of effects with EFFECT_HINT_PARTICLES, velocities
+ * included, live inside the shared mapping, so effects update the file
+ * just by running and snapshot_sync() only has to msync it now and
+ * then. On start a file with the same geometry and particle counts is
+ * resumed: the first frame shows the old picture and the particles
+ * carry on where they were. Anything else is rebuilt from scratch.
+ *
+ * Other effect state is not saved, effects restart it as usual.
+ */
+
+#define SNAPSHOT_INTERVAL 5.0 //default seconds between msyncs
+
+//after effect_enable(), before any effect starts; img->data must be NULL
+//and is pointed into the file. 1 resumed, 0 fresh, -1 on error
+int snapshot_open(const char* spec, XImage* img); //"path" or "path,seconds"
+void snapshot_sync(double now);                  //every frame, cheap until the interval is up
+
+#endif /* _SNAPSHOT_H_ */
@@ -0,0 +1,305 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "bg.h"
+#include "compose.h"
+#include "draw.h"
+#include "palette.h"
+#include "parallel.h"
+#include "stencil.h"
+
+#define STENCIL_ROWS (STENCIL_TILE + 2)
+#define STENCIL_TILE_FLOATS (STENCIL_ROWS * STENCIL_PITCH)
+#define STENCIL_RENDER_GRAIN 16 //frame rows per chunk
+#define STENCIL_LIT 1 //live flags: at or above lo now
+#define STENCIL_WAS_LIT 2 //and at the last step
+
+struct stencil
+{
+	int width, height;
+	int fields;
+	int tx, ty;     //tiles across and down
+	float* buf[2];  //tile after tile, field after field inside a tile
+	int cur;        //the buffer holding the current values
+	stencil_fn fn;
+	void* arg;
+	//stencil_render(): the field flattened with the last row and column
+	//repeated, and whether each cell is lit now or was at the last step
+	float* flat;
+	uint8_t* live;  //STENCIL_LIT | STENCIL_WAS_LIT
+	int* col;       //left cell of every frame column
+	float* colw;    //weight of the right cell
+	int cols;
+	int field;
+	float lo, scale;
+	XImage* img;
+};
+
+static void* Array(size_t count, size_t size)
+{
+	size_t bytes = (count * size + 63) & ~(size_t)63;
+	void* a = aligned_alloc(64, bytes);
+	ASSERT(a, "Out of memory!");
+	return memset(a, 0, bytes);
+}
+
+stencil_t* stencil_create(int width, int height, int fields)
+{
+	ASSERT(width > 0 && height > 0 && width <= STENCIL_MAX && height <= STENCIL_MAX, "Bad stencil size!");
+	ASSERT(fields > 0 && fields <= STENCIL_FIELDS, "Bad stencil field count!");
+	stencil_t* st = calloc(1, sizeof(*st));
+	ASSERT(st, "Out of memory!");
+	st->width = width;
+	st->height = height;
+	st->fields = fields;
+	st->tx = (width + STENCIL_TILE - 1) / STENCIL_TILE;
+	st->ty = (height + STENCIL_TILE - 1) / STENCIL_TILE;
+	for(int b = 0; b < 2; b++)
+		st->buf[b] = Array((size_t)st->tx * st->ty * fields * STENCIL_TILE_FLOATS, sizeof(float));
+	st->flat = Array((size_t)(width + 1) * (height + 1), sizeof(float));
+	st->live = Array((size_t)(width + 1) * (height + 1), 1);
+	return st;
+}
+
+void stencil_destroy(stencil_t* st)
+{
+	if(!st)
+		return;
+	free(st->buf[0]);
+	free(st->buf[1]);
+	free(st->flat);
+	free(st->live);
+	free(st->col);
+	free(st->colw);
+	free(st);
+}
+
+int stencil_width(const stencil_t* st)
+{
+	return st->width;
+}
+
+int stencil_height(const stencil_t* st)
+{
+	return st->height;
+}
+
+//cell (0, 0) of a tile's field, the halo is around it
+static float* Origin(const stencil_t* st, int b, int tile, int field)
+{
+	return st->buf[b] + ((size_t)tile * st->fields + field) * STENCIL_TILE_FLOATS + STENCIL_PITCH + STENCIL_PAD;
+}
+
+static int Extent(int tile, int size)
+{
+	return size - tile * STENCIL_TILE < STENCIL_TILE ? size - tile * STENCIL_TILE : STENCIL_TILE;
+}
+
+float* stencil_cell(stencil_t* st, int field, int x, int y)
+{
+	int tile = y / STENCIL_TILE * st->tx + x / STENCIL_TILE;
+	return Origin(st, st->cur, tile, field) + (y % STENCIL_TILE) * STENCIL_PITCH + x % STENCIL_TILE;
+}
+
+//edges only, a 5 point stencil never reads the corners
+static void Halo(stencil_t* st, int i, int j, int tw, int th)
+{
+	int tile = j * st->tx + i;
+	for(int f = 0; f < st->fields; f++)
+	{
+		float* o = Origin(st, st->cur, tile, f);
+		const float* up = j > 0 ? Origin(st, st->cur, tile - st->tx, f) + (STENCIL_TILE - 1) * STENCIL_PITCH : o;
+		const float* down = j < st->ty - 1 ? Origin(st, st->cur, tile + st->tx, f) : o + (th - 1) * STENCIL_PITCH;
+		memcpy(o - STENCIL_PITCH, up, tw * sizeof(float));
+		memcpy(o + th * STENCIL_PITCH, down, tw * sizeof(float));
+		const float* left = i > 0 ? Origin(st, st->cur, tile - 1, f) + STENCIL_TILE - 1 : o;
+		const float* right = i < st->tx - 1 ? Origin(st, st->cur, tile + 1, f) : o + tw - 1;
+		for(int y = 0; y < th; y++)
+		{
+			o[y * STENCIL_PITCH - 1] = left[y * STENCIL_PITCH];
+			o[y * STENCIL_PITCH + tw] = right[y * STENCIL_PITCH];
+		}
+	}
+}
+
+static void Tile(void* arg, int chunk, int begin, int end)
+{
+	(void)chunk;
+	stencil_t* st = arg;
+	for(int tile = begin; tile < end; tile++)
+	{
+		int i = tile % st->tx, j = tile / st->tx;
+		int tw = Extent(i, st->width), th = Extent(j, st->height);
+		int lanes = (tw + 3) & ~3;
+		//the neighbours only read our inner cells, we only write our halo
+		Halo(st, i, j, tw, th);
+		stencil_row_t row = {.x = i * STENCIL_TILE, .n = tw};
+		for(int y = 0; y < th; y++)
+		{
+			row.y = j * STENCIL_TILE + y;
+			for(int f = 0; f < st->fields; f++)
+			{
+				row.src[f] = Origin(st, st->cur, tile, f) + y * STENCIL_PITCH;
+				row.dst[f] = Origin(st, st->cur ^ 1, tile, f) + y * STENCIL_PITCH;
+			}
+			st->fn(st->arg, &row);
+			//kernels write whole lanes, keep the cells past the grid at zero
+			for(int f = 0; f < st->fields; f++)
+				memset(row.dst[f] + tw, 0, (lanes - tw) * sizeof(float));
+		}
+	}
+}
+
+void stencil_step(stencil_t* st, stencil_fn fn, void* arg)
+{
+	st->fn = fn;
+	st->arg = arg;
+	parallel_for(st->tx * st->ty, 1, Tile, st);
+	st->cur ^= 1;
+}
+
+void stencil_laplace(const stencil_row_t* row, int field, float* out)
+{
+	const float* s = row->src[field];
+	for(int x = 0; x < row->n; x += 4)
+	{
+		stencil_lanes_t v = stencil_load(s + x - STENCIL_PITCH) + stencil_load(s + x + STENCIL_PITCH)
+			+ stencil_load(s + x - 1) + stencil_load(s + x + 1) - 4 * stencil_load(s + x);
+		stencil_store(out + x, v);
+	}
+}
+
+static void Flatten(void* arg, int chunk, int begin, int end)
+{
+	(void)chunk;
+	stencil_t* st = arg;
+	int pitch = st->width + 1;
+	for(int y = begin; y < end; y++)
+	{
+		int tile = y / STENCIL_TILE * st->tx;
+		float* flat = st->flat + (size_t)y * pitch;
+		uint8_t* live = st->live + (size_t)y * pitch;
+		for(int i = 0; i < st->tx; i++)
+		{
+			const float* cur = Origin(st, st->cur, tile + i, st->field) + y % STENCIL_TILE * STENCIL_PITCH;
+			const float* prev = Origin(st, st->cur ^ 1, tile + i, st->field) + y % STENCIL_TILE * STENCIL_PITCH;
+			for(int x = 0; x < Extent(i, st->width); x++)
+			{
+				flat[i * STENCIL_TILE + x] = cur[x];
+				live[i * STENCIL_TILE + x] = (cur[x] >= st->lo ? STENCIL_LIT : 0) | (prev[x] >= st->lo ? STENCIL_WAS_LIT : 0);
+			}
+		}
+		flat[st->width] = flat[st->width - 1];
+		live[st->width] = live[st->width - 1];
+	}
+}
+
+static void Render(void* arg, int chunk, int begin, int end)
+{
+	(void)chunk;
+	stencil_t* st = arg;
+	XImage* img = st->img;
+	const uint32_t* lut = palette_lut();
+	int pitch = st->width + 1;
+	float sy = (float)st->height / img->height;
+	for(int y = begin; y < end; y++)
+	{
+		float fy = fmaxf((y + 0.5f) * sy - 0.5f, 0);
+		int cy = (int)fy;
+		float wy = fy - cy;
+		size_t r0 = (size_t)cy * pitch, r1 = r0 + pitch;
+		const float* cur = st->flat;
+		const uint8_t* live = st->live;
+		uint32_t* out = (uint32_t*)(img->data + (size_t)y * img->bytes_per_line);
+		int first = img->width, last = -1;
+		for(int x = 0; x < img->width; x++)
+		{
+			int c = st->col[x];
+			//nothing here now or at the last step, leave the pixel to the other effects
+			int lit = live[r0 + c] | live[r0 + c + 1] | live[r1 + c] | live[r1 + c + 1];
+			if(!lit)
+				continue;
+			float wx = st->colw[x];
+			float a = cur[r0 + c] + (cur[r0 + c + 1] - cur[r0 + c]) * wx;
+			float b = cur[r1 + c] + (cur[r1 + c + 1] - cur[r1 + c]) * wx;
+			float v = a + (b - a) * wy;
+			uint32_t pixel = 0;
+			if(v >= st->lo)
+			{
+				float i = (v - st->lo) * st->scale;
+				pixel = lut[i < PALETTE_MASK ? (int)i : PALETTE_MASK];
+			} else if(!(lit & STENCIL_WAS_LIT))
+				continue; //not drawn at the last step either, nothing to clear
+			if(img->bits_per_pixel == 32)
+				out[x] = pixel;
+			else
+				XPutPixel(img, x, y, pixel);
+			first = x < first ? x : first;
+			last = x;
+		}
+		if(last >= 0)
+			compose_damage(img, first, y, last - first + 1, 1);
+	}
+}
+
+//the server backend gets a rectangle per lit cell instead of pixels
+static void RenderCells(stencil_t* st, XImage* img)
+{
+	const uint32_t* lut = palette_lut();
+	int pitch = st->width + 1;
+	for(int y = 0; y < st->height; y++)
+	{
+		int y0 = y * h / st->height, y1 = (y + 1) * h / st->height;
+		for(int x = 0; x < st->width; x++)
+		{
+			int lit = st->live[(size_t)y * pitch + x];
+			if(!lit)
+				continue;
+			float v = st->flat[(size_t)y * pitch + x];
+			uint32_t pixel = 0;
+			if(v >= st->lo)
+			{
+				float i = (v - st->lo) * st->scale;
+				pixel = lut[i < PALETTE_MASK ? (int)i : PALETTE_MASK];
+			} else if(!(lit & STENCIL_WAS_LIT))
+				continue; //only the crests of the last step are cleared
+			int x0 = x * w / st->width, x1 = (x + 1) * w / st->width;
+			FillRect(img, x0, y0, x1 - x0, y1 - y0, pixel);
+		}
+	}
+}
+
+void stencil_render(stencil_t* st, int field, XImage* img, float lo, float hi)
+{
+	st->field = field;
+	st->lo = lo;
+	st->scale = PALETTE_MASK / (hi - lo);
+	st->img = img;
+	if(st->cols != img->width)
+	{
+		free(st->col);
+		free(st->colw);
+		st->cols = img->width;
+		st->col = Array(st->cols, sizeof(int));
+		st->colw = Array(st->cols, sizeof(float));
+		float sx = (float)st->width / img->width;
+		for(int x = 0; x < st->cols; x++)
+		{
+			float fx = fmaxf((x + 0.5f) * sx - 0.5f, 0);
+			st->col[x] = (int)fx < st->width - 1 ? (int)fx : st->width - 1;
+			st->colw[x] = fx - st->col[x] < 1 ? fx - st->col[x] : 1;
+		}
+	}
+	parallel_for(st->height, STENCIL_TILE, Flatten, st);
+	//the repeated last row
+	int pitch = st->width + 1;
+	memcpy(st->flat + (size_t)st->height * pitch, st->flat + (size_t)(st->height - 1) * pitch, pitch * sizeof(float));
+	memcpy(st->live + (size_t)st->height * pitch, st->live + (size_t)(st->height - 1) * pitch, pitch);
+	if(draw_server())
+		RenderCells(st, img);
+	else
+		parallel_for(img->height, STENCIL_RENDER_GRAIN, Render, st);
+}
@@ -0,0 +1,63 @@
+#ifndef _STENCIL_H_
+#define _STENCIL_H_
+
+#include <X11/Xlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/**
+ * Float fields on a grid for effects that simulate instead of draw:
+ * ripples, reaction-diffusion, smoke. The grid has its own resolution,
+ * a few hundred cells across whatever the screen size, so a step costs
+ * the same on 4K. It is stored as STENCIL_TILE square tiles, each with a
+ * one cell halo and rows padded to whole vector lanes, double buffered.
+ *
+ * stencil_step() hands the tiles out with parallel_for(); a tile first
+ * copies its halo from the neighbours' edges (clamped at the grid
+ * border) and then calls the kernel row by row. Kernels work on four
+ * cells at a time with stencil_lanes_t, stencil_laplace() is the usual
+ * convolution. stencil_render() scales a field up to the frame with
+ * bilinear filtering and maps it through the palette.
+ */
+
+#define STENCIL_TILE 64
+#define STENCIL_PAD 4    //cells left of a row: the halo and alignment
+#define STENCIL_PITCH (STENCIL_TILE + 2 * STENCIL_PAD)
+#define STENCIL_FIELDS 4
+#define STENCIL_MAX 2048 //cells on either axis
+
+typedef float stencil_lanes_t __attribute__((vector_size(16)));
+
+typedef struct stencil_row
+{
+	const float* src[STENCIL_FIELDS]; //the row's cells; [-1] and [n] are halo, +-STENCIL_PITCH the rows around
+	float* dst[STENCIL_FIELDS];
+	int x, y; //grid position of the first cell
+	int n;    //cells, both arrays have whole lanes past it
+} stencil_row_t;
+
+typedef void (*stencil_fn)(void* arg, const stencil_row_t* row);
+typedef struct stencil stencil_t;
+
+stencil_t* stencil_create(int width, int height, int fields); //fields start at 0
+void stencil_destroy(stencil_t* st);
+int stencil_width(const stencil_t* st);
+int stencil_height(const stencil_t* st);
+float* stencil_cell(stencil_t* st, int field, int x, int y); //current value, for seeding
+void stencil_step(stencil_t* st, stencil_fn fn, void* arg);   //every cell once, then the buffers swap
+void stencil_laplace(const stencil_row_t* row, int field, float* out); //5 point, n rounded up to lanes
+void stencil_render(stencil_t* st, int field, XImage* img, float lo, float hi); //cells below lo stay transparent
+
+static inline stencil_lanes_t stencil_load(const float* p)
+{
+	stencil_lanes_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void stencil_store(float* p, stencil_lanes_t v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+#endif /* _STENCIL_H_ */
@@ -0,0 +1,157 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#include <xcb/xproto.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "bg.h"
+#include "arena.h"
+#include "present.h"
+#include "submit.h"
+
+static xcb_connection_t* conn;
+static xcb_window_t sroot;
+static xcb_pixmap_t spix;
+static xcb_gcontext_t sgc;
+static uint8_t sdepth;
+static uint64_t band_bytes;
+static unsigned int fence[SUBMIT_IN_FLIGHT]; //sequence numbers of the frames' round trips
+static int fences = 0;
+static pthread_mutex_t fence_lock = PTHREAD_MUTEX_INITIALIZER; //the uploader adds, main polls
+static uint64_t frames = 0, skipped = 0, errors = 0;
+
+int submit_open(Display* dpy, int screen, Drawable pix, XImage* img)
+{
+	int s;
+	conn = xcb_connect(DisplayString(dpy), &s);
+	if(xcb_connection_has_error(conn))
+	{
+		printf("XCB connection failed, uploading with Xlib\n");
+		xcb_disconnect(conn);
+		conn = NULL;
+		return -1;
+	}
+	//the image goes out as is, it must already be in the server's format
+	int lsb = *(const uint8_t*)&(uint16_t){1};
+	const xcb_setup_t* setup = xcb_get_setup(conn);
+	if(img->bits_per_pixel != 32 || setup->image_byte_order != (lsb ? XCB_IMAGE_ORDER_LSB_FIRST : XCB_IMAGE_ORDER_MSB_FIRST))
+	{
+		printf("Image format not supported by the xcb backend, uploading with Xlib\n");
+		xcb_disconnect(conn);
+		conn = NULL;
+		return -1;
+	}
+	sroot = RootWindow(dpy, screen);
+	spix = pix;
+	sdepth = DefaultDepth(dpy, screen);
+	sgc = xcb_generate_id(conn);
+	xcb_create_gc(conn, sgc, spix, 0, NULL);
+	//enables BIG-REQUESTS where the server has it, in 4 byte units
+	uint64_t max = (uint64_t)xcb_get_maximum_request_length(conn) * 4 - 64;
+	band_bytes = max < PRESENT_BAND_BYTES ? max : PRESENT_BAND_BYTES;
+	xcb_flush(conn);
+	return 0;
+}
+
+int submit_fd(void)
+{
+	return conn ? xcb_get_file_descriptor(conn) : -1;
+}
+
+void submit_poll(void)
+{
+	if(!conn)
+		return;
+	xcb_generic_event_t* ev;
+	while((ev = xcb_poll_for_event(conn)))
+	{
+		//nothing is selected on this connection, anything here is an error
+		if(ev->response_type == 0 && errors++ < 10)
+		{
+			xcb_generic_error_t* err = (xcb_generic_error_t*)ev;
+			printf("XCB error %d on request %d.%d\n", err->error_code, err->major_code, err->minor_code);
+		}
+		free(ev);
+	}
+	pthread_mutex_lock(&fence_lock);
+	while(fences)
+	{
+		void* reply = NULL;
+		xcb_generic_error_t* err = NULL;
+		if(!xcb_poll_for_reply(conn, fence[0], &reply, &err))
+			break;
+		free(reply);
+		free(err);
+		memmove(fence, fence + 1, --fences * sizeof(fence[0]));
+	}
+	pthread_mutex_unlock(&fence_lock);
+	ASSERT(!xcb_connection_has_error(conn), "XCB connection lost!");
+}
+
+int submit_busy(void)
+{
+	submit_poll();
+	pthread_mutex_lock(&fence_lock);
+	int busy = fences >= SUBMIT_IN_FLIGHT;
+	uint64_t sent = frames;
+	pthread_mutex_unlock(&fence_lock);
+	if(!busy)
+		return 0;
+	skipped++;
+	if(!(skipped & (skipped - 1)))
+		printf("Server behind, %llu of %llu frames skipped\n", (unsigned long long)skipped, (unsigned long long)(sent + skipped));
+	return 1;
+}
+
+uint64_t submit_band_bytes(void)
+{
+	return band_bytes;
+}
+
+//rows of a part of the image are not contiguous, they are packed into the scratch arena
+void submit_put(XImage* img, int x, int y, int width, int height)
+{
+	size_t row = (size_t)width * 4;
+	int rows = row ? (int)(band_bytes / row) : height;
+	if(rows < 1)
+		rows = 1;
+	arena_t* scratch = arena_thread();
+	for(int b = y; b < y + height; b += rows)
+	{
+		int n = b + rows <= y + height ? rows : y + height - b;
+		const uint8_t* data;
+		if(x == 0 && (size_t)img->bytes_per_line == row)
+			data = (const uint8_t*)img->data + (size_t)b * img->bytes_per_line;
+		else {
+			uint8_t* packed = arena_alloc(scratch, row * n, 64);
+			for(int r = 0; r < n; r++)
+				memcpy(packed + r * row, img->data + (size_t)(b + r) * img->bytes_per_line + (size_t)x * 4, row);
+			data = packed;
+		}
+		xcb_put_image(conn, XCB_IMAGE_FORMAT_Z_PIXMAP, spix, sgc, width, n, x, b, 0, sdepth, row * n, data);
+	}
+}
+
+void submit_background(void)
+{
+	uint32_t value = spix;
+	xcb_change_window_attributes(conn, sroot, XCB_CW_BACK_PIXMAP, &value);
+}
+
+void submit_clear(int x, int y, int width, int height)
+{
+	xcb_clear_area(conn, 0, sroot, x, y, width, height);
+}
+
+void submit_end(void)
+{
+	unsigned int sequence = xcb_get_input_focus(conn).sequence;
+	pthread_mutex_lock(&fence_lock);
+	fence[fences++] = sequence;
+	frames++;
+	pthread_mutex_unlock(&fence_lock);
+	xcb_flush(conn);
+}
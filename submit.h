@@ -0,0 +1,30 @@
+#ifndef _SUBMIT_H_
+#define _SUBMIT_H_
+
+#include <X11/Xlib.h>
+#include <stdint.h>
+
+/**
+ * Asynchronous frame submission over XCB, the xcb backend. Uploads and
+ * exposes are queued on a connection of their own by the upload thread,
+ * so main never blocks writing them; every frame ends with a cheap round
+ * trip whose reply marks it as processed by the server. Up to
+ * SUBMIT_IN_FLIGHT frames may be outstanding, submit_busy() tells main
+ * to skip a frame rather than queue more. Errors and replies are read
+ * by main without blocking whenever the connection's fd becomes
+ * readable.
+ */
+
+#define SUBMIT_IN_FLIGHT 2
+
+int submit_open(Display* dpy, int screen, Drawable pix, XImage* img); //0 on success
+int submit_fd(void);
+void submit_poll(void);  //replies and errors that arrived, never blocks
+int submit_busy(void);   //SUBMIT_IN_FLIGHT frames not processed yet
+uint64_t submit_band_bytes(void);
+void submit_put(XImage* img, int x, int y, int width, int height);
+void submit_background(void);
+void submit_clear(int x, int y, int width, int height); //0 width and height for all of it
+void submit_end(void);   //closes the frame and sends it
+
+#endif /* _SUBMIT_H_ */
@@ -31,8 +31,15 @@
  * @brief Threadpool implementation file
  */
 
+#define _GNU_SOURCE
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <pthread.h>
+#include <limits.h>
+#include <sched.h>
 #include <unistd.h>
 
 #include "threadpool.h"
@@ -46,13 +53,43 @@ static void *threadpool_thread(void *threadpool);
 
 int threadpool_free(threadpool_t *pool);
 
+void threadpool_attr_init(threadpool_attr_t *attr)
+{
+    attr->max_threads = 0;
+    attr->queue_size = 64;
+    attr->idle_timeout_ms = 0;
+    attr->stack_size = 0;
+    attr->cpus = NULL;
+    attr->cpu_count = 0;
+}
+
+int threadpool_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
 threadpool_t *threadpool_create(int thread_count, int queue_size, int flags)
 {
-    threadpool_t *pool;
-    int i;
+    threadpool_attr_t attr;
     (void) flags;
 
-    if(thread_count <= 0 || thread_count > MAX_THREADS || queue_size <= 0 || queue_size > MAX_QUEUE) {
+    threadpool_attr_init(&attr);
+    attr.max_threads = thread_count;
+    attr.queue_size = queue_size;
+    return threadpool_create_attr(&attr);
+}
+
+threadpool_t *threadpool_create_attr(const threadpool_attr_t *attr)
+{
+    threadpool_t *pool;
+    int *cpus = NULL;
+    pthread_condattr_t monotonic;
+
+    if(attr->max_threads < 0 || attr->max_threads > MAX_THREADS ||
+       attr->queue_size <= 0 || attr->queue_size > MAX_QUEUE ||
+       attr->idle_timeout_ms < 0 || attr->cpu_count < 0 ||
+       (attr->stack_size && attr->stack_size < (size_t)PTHREAD_STACK_MIN)) {
         return NULL;
     }
 
@@ -61,35 +98,48 @@ threadpool_t *threadpool_create(int thread_count, int queue_size, int flags)
     }
 
     /* Initialize */
-    pool->thread_count = 0;
-    pool->queue_size = queue_size;
+    pool->attr = *attr;
+    if(pool->attr.max_threads == 0) {
+        pool->attr.max_threads = threadpool_cpu_count();
+        if(pool->attr.max_threads > MAX_THREADS) {
+            pool->attr.max_threads = MAX_THREADS;
+        }
+    }
+    pool->thread_count = pool->idle = pool->spawned = 0;
+    pool->queue_size = attr->queue_size;
     pool->head = pool->tail = pool->count = 0;
     pool->shutdown = pool->started = 0;
 
-    /* Allocate thread and task queue */
-    pool->threads = (pthread_t *)malloc(sizeof(pthread_t) * thread_count);
+    /* Allocate task queue and keep a private copy of the CPU list */
     pool->queue = (threadpool_task_t *)malloc
-        (sizeof(threadpool_task_t) * queue_size);
+        (sizeof(threadpool_task_t) * pool->queue_size);
+    if(attr->cpu_count > 0) {
+        cpus = (int *)malloc(sizeof(int) * attr->cpu_count);
+        if(cpus != NULL) {
+            memcpy(cpus, attr->cpus, sizeof(int) * attr->cpu_count);
+        }
+    }
+    pool->attr.cpus = cpus;
 
-    /* Initialize mutex and conditional variable first */
-    if((pthread_mutex_init(&(pool->lock), NULL) != 0) ||
-       (pthread_cond_init(&(pool->notify), NULL) != 0) ||
-       (pool->threads == NULL) ||
-       (pool->queue == NULL)) {
+    /* Idle deadlines are taken on the monotonic clock, so setting the
+       time cannot retire workers early or keep them forever */
+    if(pthread_condattr_init(&monotonic) != 0) {
         goto err;
     }
+    pthread_condattr_setclock(&monotonic, CLOCK_MONOTONIC);
 
-    /* Start worker threads */
-    for(i = 0; i < thread_count; i++) {
-        if(pthread_create(&(pool->threads[i]), NULL,
-                          threadpool_thread, (void*)pool) != 0) {
-            threadpool_destroy(pool, 0);
-            return NULL;
-        }
-        pool->thread_count++;
-        pool->started++;
+    /* Initialize mutex and conditional variables first */
+    if((pthread_mutex_init(&(pool->lock), NULL) != 0) ||
+       (pthread_cond_init(&(pool->notify), &monotonic) != 0) ||
+       (pthread_cond_init(&(pool->exited), NULL) != 0) ||
+       (pool->queue == NULL) ||
+       (attr->cpu_count > 0 && cpus == NULL)) {
+        pthread_condattr_destroy(&monotonic);
+        goto err;
     }
+    pthread_condattr_destroy(&monotonic);
 
+    /* Workers are spawned on demand by threadpool_add */
     return pool;
 
  err:
@@ -99,6 +149,68 @@ threadpool_t *threadpool_create(int thread_count, int queue_size, int flags)
     return NULL;
 }
 
+/**
+ * @function threadpool_spawn
+ * @brief Starts one detached worker, called with pool->lock held.
+ *
+ * A stack size or CPU the system refuses is reported and the worker
+ * starts with the default instead.
+ */
+static int threadpool_spawn(threadpool_t *pool)
+{
+    pthread_attr_t tattr;
+    pthread_t thread;
+    int custom = 0;
+    int err;
+
+    if(pthread_attr_init(&tattr) != 0) {
+        return threadpool_thread_failure;
+    }
+    pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+    if(pool->attr.stack_size) {
+        if((err = pthread_attr_setstacksize(&tattr, pool->attr.stack_size)) != 0) {
+            fprintf(stderr, "threadpool: stack size %zu refused (%s), default stack\n",
+                    pool->attr.stack_size, strerror(err));
+        } else {
+            custom = 1;
+        }
+    }
+    if(pool->attr.cpu_count > 0) {
+        int cpu = pool->attr.cpus[pool->spawned % pool->attr.cpu_count];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if((err = pthread_attr_setaffinity_np(&tattr, sizeof(set), &set)) != 0) {
+            fprintf(stderr, "threadpool: cannot pin to CPU %d (%s), unpinned\n",
+                    cpu, strerror(err));
+        } else {
+            custom = 1;
+        }
+    }
+
+    err = pthread_create(&thread, &tattr, threadpool_thread, (void*)pool);
+    pthread_attr_destroy(&tattr);
+    if(err != 0 && custom) {
+        /* An offline CPU or a stack over the limit only shows up here */
+        fprintf(stderr, "threadpool: worker not started (%s), retrying with defaults\n",
+                strerror(err));
+        if(pthread_attr_init(&tattr) != 0) {
+            return threadpool_thread_failure;
+        }
+        pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+        err = pthread_create(&thread, &tattr, threadpool_thread, (void*)pool);
+        pthread_attr_destroy(&tattr);
+    }
+    if(err != 0) {
+        fprintf(stderr, "threadpool: worker not started (%s)\n", strerror(err));
+        return threadpool_thread_failure;
+    }
+    pool->thread_count++;
+    pool->started++;
+    pool->spawned++;
+    return 0;
+}
+
 int threadpool_add(threadpool_t *pool, void (*function)(void *),
                    void *argument, int flags)
 {
@@ -135,6 +247,18 @@ int threadpool_add(threadpool_t *pool, void (*function)(void *),
         pool->tail = next;
         pool->count += 1;
 
+        /* Grow when every idle worker already has a task waiting. If
+           that fails nobody may take the task for a long time (workers
+           can be busy with long running tasks), so take it back. */
+        if(pool->count > pool->idle &&
+           pool->thread_count < pool->attr.max_threads &&
+           threadpool_spawn(pool) != 0) {
+            pool->tail = (pool->tail + pool->queue_size - 1) % pool->queue_size;
+            pool->count -= 1;
+            err = threadpool_thread_failure;
+            break;
+        }
+
         /* pthread_cond_broadcast */
         if(pthread_cond_signal(&(pool->notify)) != 0) {
             err = threadpool_lock_failure;
@@ -151,7 +275,7 @@ int threadpool_add(threadpool_t *pool, void (*function)(void *),
 
 int threadpool_destroy(threadpool_t *pool, int flags)
 {
-    int i, err = 0;
+    int err = 0;
 
     if(pool == NULL) {
         return threadpool_invalid;
@@ -172,20 +296,21 @@ int threadpool_destroy(threadpool_t *pool, int flags)
             graceful_shutdown : immediate_shutdown;
 
         /* Wake up all worker threads */
-        if((pthread_cond_broadcast(&(pool->notify)) != 0) ||
-           (pthread_mutex_unlock(&(pool->lock)) != 0)) {
+        if(pthread_cond_broadcast(&(pool->notify)) != 0) {
             err = threadpool_lock_failure;
             break;
         }
 
-        /* Join all worker thread */
-        for(i = 0; i < pool->thread_count; i++) {
-            if(pthread_join(pool->threads[i], NULL) != 0) {
-                err = threadpool_thread_failure;
-            }
+        /* Workers are detached, wait for the last one to check out */
+        while(pool->started > 0) {
+            pthread_cond_wait(&(pool->exited), &(pool->lock));
         }
     } while(0);
 
+    if(pthread_mutex_unlock(&(pool->lock)) != 0) {
+        err = threadpool_lock_failure;
+    }
+
     /* Only if everything went well do we deallocate the pool */
     if(!err) {
         threadpool_free(pool);
@@ -200,17 +325,19 @@ int threadpool_free(threadpool_t *pool)
     }
 
     /* Did we manage to allocate ? */
-    if(pool->threads) {
-        free(pool->threads);
+    if(pool->queue) {
         free(pool->queue);
  
-        /* Because we allocate pool->threads after initializing the
-           mutex and condition variable, we're sure they're
+        /* Because we allocate pool->queue after initializing the
+           mutex and condition variables, we're sure they're
            initialized. Let's lock the mutex just in case. */
         pthread_mutex_lock(&(pool->lock));
+        pthread_mutex_unlock(&(pool->lock));
         pthread_mutex_destroy(&(pool->lock));
         pthread_cond_destroy(&(pool->notify));
+        pthread_cond_destroy(&(pool->exited));
     }
+    free((void *)pool->attr.cpus);
     free(pool);    
     return 0;
 }
@@ -219,6 +346,8 @@ static void *threadpool_thread(void *threadpool)
 {
     threadpool_t *pool = (threadpool_t *)threadpool;
     threadpool_task_t task;
+    struct timespec deadline;
+    int timedout;
 
     for(;;) {
         /* Lock must be taken to wait on conditional variable */
@@ -226,8 +355,30 @@ static void *threadpool_thread(void *threadpool)
 
         /* Wait on condition variable, check for spurious wakeups.
            When returning from pthread_cond_wait(), we own the lock. */
-        while((pool->count == 0) && (!pool->shutdown)) {
-            pthread_cond_wait(&(pool->notify), &(pool->lock));
+        timedout = 0;
+        if(pool->attr.idle_timeout_ms > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += pool->attr.idle_timeout_ms / 1000;
+            deadline.tv_nsec += (long)(pool->attr.idle_timeout_ms % 1000) * 1000000;
+            if(deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+        }
+        pool->idle++;
+        while((pool->count == 0) && (!pool->shutdown) && !timedout) {
+            if(pool->attr.idle_timeout_ms > 0) {
+                timedout = pthread_cond_timedwait(&(pool->notify),
+                    &(pool->lock), &deadline) == ETIMEDOUT;
+            } else {
+                pthread_cond_wait(&(pool->notify), &(pool->lock));
+            }
+        }
+        pool->idle--;
+
+        /* Retire when idle for too long */
+        if(timedout && pool->count == 0) {
+            break;
         }
 
         if((pool->shutdown == immediate_shutdown) ||
@@ -250,6 +401,8 @@ static void *threadpool_thread(void *threadpool)
     }
 
     pool->started--;
+    pool->thread_count--;
+    pthread_cond_broadcast(&(pool->exited));
 
     pthread_mutex_unlock(&(pool->lock));
     pthread_exit(NULL);
@@ -78,13 +78,37 @@ typedef struct {
     void *argument;
 } threadpool_task_t;
 
+/**
+ *  @struct threadpool_attr
+ *  @brief Creation parameters for threadpool_create_attr()
+ *
+ *  @var max_threads     Upper bound of worker threads, 0 means online CPUs.
+ *  @var queue_size      Size of the task queue.
+ *  @var idle_timeout_ms Idle workers retire after this long, 0 keeps them.
+ *  @var stack_size      Worker stack size in bytes, 0 for system default.
+ *  @var cpus            Optional CPU list, worker n is pinned to
+ *                       cpus[n % cpu_count].
+ *  @var cpu_count       Number of entries in cpus.
+ */
+typedef struct {
+    int max_threads;
+    int queue_size;
+    int idle_timeout_ms;
+    size_t stack_size;
+    const int *cpus;
+    int cpu_count;
+} threadpool_attr_t;
+
 /**
  *  @struct threadpool
  *  @brief The threadpool struct
  *
  *  @var notify       Condition variable to notify worker threads.
- *  @var threads      Array containing worker threads ID.
- *  @var thread_count Number of threads
+ *  @var exited       Condition variable signalled when a worker exits.
+ *  @var attr         Creation parameters.
+ *  @var thread_count Number of live threads
+ *  @var idle         Number of threads waiting for work
+ *  @var spawned      Number of threads ever spawned, used for pinning
  *  @var queue        Array containing the task queue.
  *  @var queue_size   Size of the task queue.
  *  @var head         Index of the first element.
@@ -96,9 +120,12 @@ typedef struct {
 typedef struct threadpool_t {
   pthread_mutex_t lock;
   pthread_cond_t notify;
-  pthread_t *threads;
+  pthread_cond_t exited;
+  threadpool_attr_t attr;
   threadpool_task_t *queue;
   int thread_count;
+  int idle;
+  int spawned;
   int queue_size;
   int head;
   int tail;
@@ -110,13 +137,38 @@ typedef struct threadpool_t {
 /**
  * @function threadpool_create
  * @brief Creates a threadpool_t object.
- * @param thread_count Number of worker threads.
+ * @param thread_count Maximum number of worker threads.
  * @param queue_size   Size of the queue.
  * @param flags        Unused parameter.
  * @return a newly created thread pool or NULL
  */
 threadpool_t *threadpool_create(int thread_count, int queue_size, int flags);
 
+/**
+ * @function threadpool_create_attr
+ * @brief Creates an elastic threadpool_t object.
+ * @param attr Creation parameters, see threadpool_attr_init().
+ * @return a newly created thread pool or NULL
+ *
+ * No worker is started up front. Workers are spawned when a task is
+ * queued and no idle worker can take it, up to attr->max_threads, and
+ * retire after attr->idle_timeout_ms without work.
+ */
+threadpool_t *threadpool_create_attr(const threadpool_attr_t *attr);
+
+/**
+ * @function threadpool_attr_init
+ * @brief Fills attr with defaults: online CPUs, no idle timeout,
+ * default stack and no pinning.
+ */
+void threadpool_attr_init(threadpool_attr_t *attr);
+
+/**
+ * @function threadpool_cpu_count
+ * @brief Number of online CPUs, at least 1.
+ */
+int threadpool_cpu_count(void);
+
 /**
  * @function threadpool_add
  * @brief add a new task in the queue of a thread pool
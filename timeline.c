@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "bg.h"
+#include "effect.h"
+#include "timeline.h"
+
+#define MAX_STEPS 256
+#define PREPARE_LEAD 1.0
+
+struct step
+{
+	double duration;
+	double overlap;  //effects new in this step start this long before it
+	uint64_t run;    //bit per effect id
+	int signal;
+	int hold;        //re-asserted every tick, see signals[]
+	int budget;
+};
+
+static struct step steps[MAX_STEPS];
+static int nsteps = 0;
+static int loop = 0;
+static int current = -1;
+static double step_end;
+static int started_next;
+static int prepared_next;
+
+//names for the shared signal values the built-in effects react to
+//states are held for the step, a kick is set once at its start
+static const struct {
+	const char* name;
+	int value;
+	int hold;
+} signals[] = {
+	{"none", 0, 0},
+	{"fill", 1, 1},    //CirclePurge fills instead of drawing rings
+	{"chaos", 2, 0},   //Galaxy scatters its particles once and resets it
+	{"fractal", 5, 1}, //CircleFrac draws recursive circles
+};
+
+static int Cost(uint64_t run)
+{
+	int cost = 0;
+	for(int id = 1; id <= effect_count(); id++)
+		if(run & (1ull << id))
+			cost += effect_get(id)->cost;
+	return cost;
+}
+
+static int ParseEffects(const char* list, uint64_t* run, int line)
+{
+	char name[64];
+	*run = 0;
+	if(!strcmp(list, "-"))
+		return 0;
+	while(*list)
+	{
+		size_t len = strcspn(list, ",");
+		if(len >= sizeof(name))
+			len = sizeof(name) - 1;
+		memcpy(name, list, len);
+		name[len] = 0;
+		int id = effect_find(name);
+		if(!id)
+		{
+			printf("timeline:%d: unknown effect %s\n", line, name);
+			return -1;
+		}
+		*run |= 1ull << id;
+		effect_opt_in(id);
+		list += strcspn(list, ",");
+		if(*list == ',')
+			list++;
+	}
+	return 0;
+}
+
+static int ParseOption(const char* opt, struct step* s, int line)
+{
+	const char* val = strchr(opt, '=');
+	if(!val)
+		goto bad;
+	val++;
+	if(!strncmp(opt, "signal=", 7))
+	{
+		for(size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+			if(!strcmp(val, signals[i].name))
+			{
+				s->signal = signals[i].value;
+				s->hold = signals[i].hold;
+				return 0;
+			}
+	} else if(!strncmp(opt, "budget=", 7)) {
+		s->budget = atoi(val);
+		return 0;
+	} else if(!strncmp(opt, "overlap=", 8)) {
+		s->overlap = atof(val);
+		return s->overlap < 0 ? -1 : 0;
+	}
+	bad:
+	printf("timeline:%d: bad option %s\n", line, opt);
+	return -1;
+}
+
+int timeline_load(const char* path)
+{
+	FILE* f = fopen(path, "r");
+	char buf[512];
+	int line = 0;
+	int budget = 0;
+	if(!f)
+	{
+		perror(path);
+		return -1;
+	}
+	while(fgets(buf, sizeof(buf), f))
+	{
+		char* tok[16];
+		int n = 0;
+		line++;
+		buf[strcspn(buf, "#\n")] = 0;
+		for(char* t = strtok(buf, " \t"); t && n < 16; t = strtok(NULL, " \t"))
+			tok[n++] = t;
+		if(n == 0)
+			continue;
+		if(!strcmp(tok[0], "loop"))
+		{
+			loop = 1;
+			continue;
+		}
+		if(!strcmp(tok[0], "budget") && n == 2)
+		{
+			budget = atoi(tok[1]);
+			continue;
+		}
+		struct step* s = &steps[nsteps];
+		char* end;
+		memset(s, 0, sizeof(*s));
+		s->budget = budget;
+		s->duration = strtod(tok[0], &end);
+		if(n < 2 || *end || s->duration <= 0 || nsteps == MAX_STEPS)
+		{
+			printf("timeline:%d: expected <seconds> <effects> [options]\n", line);
+			goto err;
+		}
+		if(ParseEffects(tok[1], &s->run, line))
+			goto err;
+		for(int i = 2; i < n; i++)
+			if(ParseOption(tok[i], s, line))
+				goto err;
+		//the step before is still running during the overlap
+		uint64_t peak = s->run;
+		if(nsteps > 0 && s->overlap > 0)
+			peak |= steps[nsteps - 1].run;
+		if(s->budget > 0 && Cost(peak) > s->budget)
+		{
+			printf("timeline:%d: effects cost %d, over the budget of %d\n", line, Cost(peak), s->budget);
+			goto err;
+		}
+		nsteps++;
+	}
+	fclose(f);
+	if(nsteps == 0)
+	{
+		printf("timeline: %s has no steps\n", path);
+		return -1;
+	}
+	//looping, the first step overlaps the last one
+	uint64_t wrap = steps[0].run | steps[nsteps - 1].run;
+	if(loop && steps[0].overlap > 0 && steps[0].budget > 0 && Cost(wrap) > steps[0].budget)
+	{
+		printf("timeline: looping back to the first step costs %d, over its budget of %d\n", Cost(wrap), steps[0].budget);
+		return -1;
+	}
+	return 0;
+	err:
+	fclose(f);
+	return -1;
+}
+
+static int Next()
+{
+	if(current + 1 < nsteps)
+		return current + 1;
+	return loop ? 0 : -1;
+}
+
+//starts what should run but does not, e.g. after a stop raced with a restart
+static void Reconcile(uint64_t run)
+{
+	for(int id = 1; id <= effect_count(); id++)
+		if((run >> id) & 1 && !effect_running(id))
+			ASSERT(effect_start(id) == 0, "Failed effect_start");
+}
+
+static void Enter(int k, double now)
+{
+	struct step* s = &steps[k];
+	for(int id = 1; id <= effect_count(); id++)
+		if(!((s->run >> id) & 1) && effect_running(id))
+			effect_stop(id);
+	Reconcile(s->run);
+	SetSignal(s->signal);
+	current = k;
+	step_end = now + s->duration;
+	started_next = 0;
+	prepared_next = 0;
+}
+
+void timeline_start(double now)
+{
+	Enter(0, now);
+}
+
+void timeline_tick(double now)
+{
+	int next = Next();
+	if(current < 0)
+		return;
+	Reconcile(steps[current].run | (started_next ? steps[next].run : 0));
+	//SnowFlake's wipe request or a feedback reset must not end a held signal
+	if(steps[current].hold && GetSignal() != steps[current].signal)
+		SetSignal(steps[current].signal);
+	if(next < 0)
+		return; //the last step lasts forever
+	if(now >= step_end)
+	{
+		Enter(next, now);
+		return;
+	}
+	uint64_t fresh = steps[next].run & ~steps[current].run;
+	if(!prepared_next && now >= step_end - steps[next].overlap - PREPARE_LEAD)
+	{
+		for(int id = 1; id <= effect_count(); id++)
+			if((fresh >> id) & 1)
+				effect_prepare(id);
+		prepared_next = 1;
+	}
+	if(!started_next && steps[next].overlap > 0 && now >= step_end - steps[next].overlap)
+	{
+		Reconcile(fresh);
+		started_next = 1;
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef _TIMELINE_H_
+#define _TIMELINE_H_
+
+/**
+ * Declarative choreography replacing the random signal generator. A
+ * timeline file is a list of steps, one per line:
+ *
+ *   <seconds> <effect,effect,...|-> [signal=S] [budget=N] [overlap=SECONDS]
+ *
+ * The listed effects run for the duration of the step, everything else
+ * is stopped at the boundary. signal=fill and signal=fractal hold for
+ * the whole step, they are set again on every tick if an effect or a
+ * feedback changed them; signal=chaos is a kick at the start of the
+ * step, Galaxy scatters once and clears it. budget caps the summed effect costs, including the
+ * previous step's effects while overlap keeps both running. The
+ * directives "budget N" (default for later steps) and "loop" may appear
+ * on their own lines. Effects new in the next step are initialised on a
+ * worker a second before they are needed.
+ */
+
+int timeline_load(const char* path); //0 on success, prints what is wrong otherwise
+void timeline_start(double now);
+void timeline_tick(double now);      //called once per frame
+
+#endif /* _TIMELINE_H_ */
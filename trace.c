@@ -0,0 +1,182 @@
+#ifdef TRACE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "bg.h"
+#include "trace.h"
+
+typedef struct
+{
+	uint64_t ns;
+	const char* name;
+	int64_t value;
+	char phase;
+} trace_ev_t;
+
+typedef struct trace_ring
+{
+	trace_ev_t ev[TRACE_EVENTS];
+	uint64_t head;          //events ever written, only the owner stores it
+	int tid;
+	int idle;               //its thread exited, the next new thread takes it over
+	char thread[16];
+	struct trace_ring* next;
+} trace_ring_t;
+
+static __thread trace_ring_t* ring;
+//every ring, pushed lock-free and never freed; retired workers' rings are
+//reused, so there are as many as threads ever ran at once
+static trace_ring_t* rings = NULL;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static int next_tid = 0;
+static volatile sig_atomic_t requested = 0; //1 = dump, 2 = dump and exit
+
+static uint64_t Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//the events stay for the dump until the next owner overwrites them
+static void Retire(void* r)
+{
+	__atomic_store_n(&((trace_ring_t*)r)->idle, 1, __ATOMIC_RELEASE);
+}
+
+static void RingKey(void)
+{
+	ASSERT(pthread_key_create(&ring_key, Retire) == 0, "Unable to create trace key!");
+}
+
+static trace_ring_t* Ring(void)
+{
+	pthread_once(&ring_once, RingKey);
+	trace_ring_t* r;
+	for(r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next)
+	{
+		int idle = 1;
+		if(__atomic_load_n(&r->idle, __ATOMIC_RELAXED)
+			&& __atomic_compare_exchange_n(&r->idle, &idle, 0, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break; //same track, the events go on after the last owner's
+	}
+	if(!r)
+	{
+		r = calloc(1, sizeof(*r));
+		ASSERT(r, "Out of memory!");
+		r->tid = __atomic_add_fetch(&next_tid, 1, __ATOMIC_RELAXED);
+		r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&rings, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+	if(pthread_getname_np(pthread_self(), r->thread, sizeof(r->thread)))
+		snprintf(r->thread, sizeof(r->thread), "thread %d", r->tid);
+	pthread_setspecific(ring_key, r);
+	return r;
+}
+
+void trace_event(char phase, const char* name, int64_t value)
+{
+	trace_ring_t* r = ring;
+	if(!r)
+		r = ring = Ring();
+	uint64_t head = r->head;
+	trace_ev_t* e = &r->ev[head & (TRACE_EVENTS - 1)];
+	e->ns = Now();
+	e->name = name;
+	e->value = value;
+	e->phase = phase;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_lock(pthread_mutex_t* m, const char* name)
+{
+	if(pthread_mutex_trylock(m) == 0)
+		return;
+	trace_event('B', name, 0);
+	pthread_mutex_lock(m);
+	trace_event('E', name, 0);
+}
+
+//the owners keep writing meanwhile, events overwritten while they were
+//copied are dropped by checking the head again afterwards
+static void Dump(void)
+{
+	const char* path = getenv("BG_TRACE");
+	if(!path || !*path)
+		path = "bg-trace.json";
+	FILE* f = fopen(path, "w");
+	if(!f)
+	{
+		printf("Unable to write trace %s\n", path);
+		return;
+	}
+	trace_ev_t* copy = malloc(sizeof(trace_ev_t) * TRACE_EVENTS);
+	ASSERT(copy, "Out of memory!");
+	uint64_t events = 0;
+	int pid = getpid();
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for(trace_ring_t* r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next)
+	{
+		fprintf(f, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+			pid, r->tid, r->thread);
+		uint64_t end = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint64_t first = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+		for(uint64_t i = first; i < end; i++)
+			copy[i - first] = r->ev[i & (TRACE_EVENTS - 1)];
+		//the slot of event head - TRACE_EVENTS may be half written
+		uint64_t now = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) + 1;
+		uint64_t valid = now > TRACE_EVENTS ? now - TRACE_EVENTS : 0;
+		for(uint64_t i = valid > first ? valid : first; i < end; i++)
+		{
+			trace_ev_t* e = &copy[i - first];
+			if(e->phase == 'C')
+				fprintf(f, "{\"ph\":\"C\",\"name\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"value\":%lld}},\n",
+					e->name, e->ns / 1000.0, pid, r->tid, (long long)e->value);
+			else
+				fprintf(f, "{\"ph\":\"%c\",\"name\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d},\n",
+					e->phase, e->name, e->ns / 1000.0, pid, r->tid);
+			events++;
+		}
+	}
+	//the metadata event closes the trailing comma
+	fprintf(f, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"bg\"}}\n]}\n", pid);
+	fclose(f);
+	free(copy);
+	printf("Trace of %llu events written to %s\n", (unsigned long long)events, path);
+}
+
+static void OnSignal(int sig)
+{
+	requested = sig == SIGUSR1 ? 1 : 2;
+}
+
+void trace_init(void)
+{
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = OnSignal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	atexit(Dump);
+}
+
+void trace_poll(void)
+{
+	int r = requested;
+	if(!r)
+		return;
+	requested = 0;
+	if(r == 2)
+		exit(0); //Dump runs from atexit
+	Dump();
+}
+
+#endif /* TRACE */
@@ -0,0 +1,42 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * Span and counter tracing, built with `make trace` (-DTRACE) and
+ * compiled out completely otherwise. Every thread appends timestamped
+ * events to a ring of its own, TRACE_EVENTS deep, without locks; the
+ * oldest events are overwritten. On SIGUSR1 and at exit the rings are
+ * written as a Chrome trace (chrome://tracing, ui.perfetto.dev) to
+ * $BG_TRACE, bg-trace.json by default. Names must be string literals
+ * or otherwise outlive the process.
+ */
+
+#define TRACE_EVENTS (1 << 16)
+
+#ifdef TRACE
+
+void trace_init(void);  //installs the signal handlers, main only
+void trace_poll(void);  //writes the trace if a signal asked for it, main loop
+void trace_event(char phase, const char* name, int64_t value);
+void trace_lock(pthread_mutex_t* m, const char* name); //records only contended waits
+
+# define TRACE_BEGIN(name) trace_event('B', name, 0)
+# define TRACE_END(name) trace_event('E', name, 0)
+# define TRACE_COUNTER(name, value) trace_event('C', name, value)
+# define TRACE_LOCK(m) trace_lock(m, "wait " #m)
+
+#else
+
+# define trace_init() do { } while (0)
+# define trace_poll() do { } while (0)
+# define TRACE_BEGIN(name) do { } while (0)
+# define TRACE_END(name) do { } while (0)
+# define TRACE_COUNTER(name, value) do { } while (0)
+# define TRACE_LOCK(m) pthread_mutex_lock(m)
+
+#endif
+
+#endif /* _TRACE_H_ */
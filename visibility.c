@@ -0,0 +1,132 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/scrnsaver.h>
+#include <X11/extensions/dpms.h>
+#include <stdio.h>
+#include "visibility.h"
+
+#define MAX_ROOTS 16
+
+static Display* vdpy;
+static Window vroots[MAX_ROOTS];
+static int covered[MAX_ROOTS];
+static int num_roots = 0;
+static int has_saver;
+static int has_dpms;
+static int dirty = 1;
+static XErrorHandler previous_handler; //while RootCovered() runs
+
+//top-level windows can vanish between XQueryTree and XGetWindowAttributes
+static int IgnoreBadWindow(Display* dpy, XErrorEvent* err)
+{
+	if(dpy == vdpy && (err->error_code == BadWindow || err->error_code == BadDrawable))
+		return 0;
+	return previous_handler(dpy, err);
+}
+
+void visibility_init(Display* dpy, Window root)
+{
+	int event, error;
+	if(num_roots == MAX_ROOTS)
+		return;
+	if(!num_roots)
+	{
+		vdpy = dpy;
+		has_saver = XScreenSaverQueryExtension(dpy, &event, &error);
+		has_dpms = DPMSQueryExtension(dpy, &event, &error) && DPMSCapable(dpy);
+	}
+	vroots[num_roots++] = root;
+	dirty = 1;
+	XSelectInput(dpy, root, SubstructureNotifyMask);
+	if(has_saver)
+		XScreenSaverSelectInput(dpy, root, ScreenSaverNotifyMask);
+}
+
+void visibility_event(XEvent* ev)
+{
+	switch(ev->type)
+	{
+		case MapNotify:
+		case UnmapNotify:
+		case ConfigureNotify:
+		case DestroyNotify:
+		case CirculateNotify:
+			dirty = 1;
+			break;
+	}
+}
+
+//subtracts every viewable top-level window from the root area
+static int RootCovered(Window vroot)
+{
+	Window r, parent, *children = NULL;
+	unsigned int n;
+	XWindowAttributes attr;
+	XRectangle rect;
+	int empty;
+
+	if(!XGetWindowAttributes(vdpy, vroot, &attr))
+		return 0;
+	Region visible = XCreateRegion();
+	rect.x = 0;
+	rect.y = 0;
+	rect.width = attr.width;
+	rect.height = attr.height;
+	XUnionRectWithRegion(&rect, visible, visible);
+
+	if(XQueryTree(vdpy, vroot, &r, &parent, &children, &n))
+	{
+		Region win = XCreateRegion();
+		for(unsigned int i = 0; i < n; i++)
+		{
+			if(!XGetWindowAttributes(vdpy, children[i], &attr))
+				continue;
+			if(attr.map_state != IsViewable || attr.class != InputOutput)
+				continue;
+			rect.x = attr.x;
+			rect.y = attr.y;
+			rect.width = attr.width + 2 * attr.border_width;
+			rect.height = attr.height + 2 * attr.border_width;
+			XUnionRectWithRegion(&rect, win, win);
+		}
+		XSubtractRegion(visible, win, visible);
+		XDestroyRegion(win);
+		if(children)
+			XFree(children);
+	}
+	empty = XEmptyRegion(visible);
+	XDestroyRegion(visible);
+	return empty;
+}
+
+int visibility_check(void)
+{
+	if(has_dpms)
+	{
+		CARD16 level;
+		BOOL enabled;
+		if(DPMSInfo(vdpy, &level, &enabled) && enabled && level != DPMSModeOn)
+			return 0;
+	}
+	if(dirty)
+	{
+		//only the errors of this query are ignored, earlier ones are reported first
+		XSync(vdpy, False);
+		previous_handler = XSetErrorHandler(IgnoreBadWindow);
+		for(int i = 0; i < num_roots; i++)
+			covered[i] = RootCovered(vroots[i]);
+		XSync(vdpy, False);
+		XSetErrorHandler(previous_handler);
+		dirty = 0;
+	}
+	//the simulation is shared, one visible screen keeps it running
+	for(int i = 0; i < num_roots; i++)
+	{
+		XScreenSaverInfo info;
+		if(has_saver && XScreenSaverQueryInfo(vdpy, vroots[i], &info) && info.state == ScreenSaverOn)
+			continue;
+		if(!covered[i])
+			return 1;
+	}
+	return 0;
+}
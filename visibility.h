@@ -0,0 +1,17 @@
+#ifndef _VISIBILITY_H_
+#define _VISIBILITY_H_
+
+#include <X11/Xlib.h>
+
+/**
+ * Tracks whether anybody can see the root window. It is hidden when
+ * viewable top-level windows cover all of it, the screensaver is active
+ * or DPMS has switched the monitors off. Structure changes arrive as X
+ * events, the screensaver and DPMS state is polled.
+ */
+
+void visibility_init(Display* dpy, Window root); //once per screen, hidden means all are
+void visibility_event(XEvent* ev); //feed every X event, marks the stacking dirty
+int visibility_check(void);        //1 if the root window can be seen
+
+#endif /* _VISIBILITY_H_ */